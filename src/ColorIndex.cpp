@@ -0,0 +1,241 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorIndex.cpp
+//
+//      Implementation of ColorIndex methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ColorIndex.h"
+#include "ColorQuant.h"
+
+#ifdef HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
+// constants
+const int   c_gridShift     = 5;                            // buckets are 32 values wide per channel
+const int   c_gridSize      = 256 >> c_gridShift;           // buckets per channel
+const int   c_nBuckets      = c_gridSize * c_gridSize * c_gridSize;
+const short c_padChannel    = 16383;                        // channel value of padding candidates, never nearest
+
+
+// squared distance from a channel value to the nearest and farthest points of [low, high]
+static inline void ChannelDistances(int value, int low, int high, int& nearest, int& farthest)
+{
+    int d = value < low ? low - value : (value > high ? value - high : 0);
+    int f = Max(value - low, high - value);
+    nearest = d * d;
+    farthest = f * f;
+}// ChannelDistances
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The index is empty until built.
+//
+///////////////////////////////////////////////////////////////////////////////
+ColorIndex::ColorIndex()
+{}// ColorIndex
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the index over the given palette.  A color can only be nearest to
+//  some point of a bucket if its distance to the bucket does not exceed the
+//  smallest distance any color has to the bucket's farthest corner, so only
+//  those colors are kept as candidates.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ColorIndex::Build(const Palette& palette)
+{
+    int nColors = palette.Size();
+    std::vector<int> vNearest(nColors);
+
+    m_vRG.clear();
+    m_vB0.clear();
+    m_vIndex.clear();
+    m_vBucketStart.resize(c_nBuckets + 1);
+
+    for (int bucket = 0; bucket < c_nBuckets; ++bucket)
+    {
+        int aLow[3] = { (bucket / (c_gridSize * c_gridSize)) << c_gridShift,
+                        ((bucket / c_gridSize) % c_gridSize) << c_gridShift,
+                        (bucket % c_gridSize) << c_gridShift };
+        int limit = 0x7FFFFFFF;
+
+        for (int i = 0; i < nColors; ++i)
+        {
+            const Palette::Color& color = palette[i];
+            int aValue[3] = { color.r, color.g, color.b };
+            int nearest = 0,
+                farthest = 0;
+
+            for (int c = 0; c < 3; ++c)
+            {
+                int channelNearest, channelFarthest;
+                ChannelDistances(aValue[c], aLow[c], aLow[c] + (1 << c_gridShift) - 1, channelNearest, channelFarthest);
+                nearest += channelNearest;
+                farthest += channelFarthest;
+            }// for
+
+            vNearest[i] = nearest;
+            limit = Min(limit, farthest);
+        }// for
+
+        m_vBucketStart[bucket] = (int)m_vIndex.size();
+        for (int i = 0; i < nColors; ++i)
+        {
+            if (vNearest[i] > limit)
+                continue;
+
+            m_vRG.push_back(palette[i].r);
+            m_vRG.push_back(palette[i].g);
+            m_vB0.push_back(palette[i].b);
+            m_vB0.push_back(0);
+            m_vIndex.push_back(i);
+        }// for
+
+        while (m_vIndex.size() & 3)
+        {
+            m_vRG.push_back(c_padChannel);
+            m_vRG.push_back(c_padChannel);
+            m_vB0.push_back(c_padChannel);
+            m_vB0.push_back(0);
+            m_vIndex.push_back(m_vIndex.back());
+        }// while
+    }// for
+    m_vBucketStart[c_nBuckets] = (int)m_vIndex.size();
+}// Build
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Index of the palette color nearest to the given color.  Only the
+//  candidates of the color's bucket are scanned, four at a time.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ColorIndex::Nearest(int r, int g, int b) const
+{
+    r = Min(Max(r, 0), 255);
+    g = Min(Max(g, 0), 255);
+    b = Min(Max(b, 0), 255);
+
+    int bucket = (((r >> c_gridShift) * c_gridSize) + (g >> c_gridShift)) * c_gridSize + (b >> c_gridShift);
+    int begin = m_vBucketStart[bucket],
+        end = m_vBucketStart[bucket + 1];
+
+    int bestDistance = 0x7FFFFFFF,
+        bestSlot = begin;
+
+#ifdef HAVE_SSE2
+    const __m128i   queryRG = _mm_set_epi16((short)g, (short)r, (short)g, (short)r, (short)g, (short)r, (short)g, (short)r);
+    const __m128i   queryB0 = _mm_set_epi16(0, (short)b, 0, (short)b, 0, (short)b, 0, (short)b);
+    const __m128i   four = _mm_set1_epi32(4);
+    __m128i         slots = _mm_set_epi32(begin + 3, begin + 2, begin + 1, begin);
+    __m128i         best = _mm_set1_epi32(0x7FFFFFFF);
+    __m128i         bestSlots = slots;
+
+    for (int i = begin; i < end; i += 4)
+    {
+        __m128i deltaRG = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)&m_vRG[i * 2]), queryRG);
+        __m128i deltaB0 = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)&m_vB0[i * 2]), queryB0);
+        __m128i distance = _mm_add_epi32(_mm_madd_epi16(deltaRG, deltaRG), _mm_madd_epi16(deltaB0, deltaB0));
+
+        // strictly closer only, so each lane keeps its earliest candidate on ties
+        __m128i closer = _mm_cmplt_epi32(distance, best);
+        best = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+        bestSlots = _mm_or_si128(_mm_and_si128(closer, slots), _mm_andnot_si128(closer, bestSlots));
+        slots = _mm_add_epi32(slots, four);
+    }// for
+
+    int aBest[4], aBestSlots[4];
+    _mm_storeu_si128((__m128i*)aBest, best);
+    _mm_storeu_si128((__m128i*)aBestSlots, bestSlots);
+
+    for (int lane = 0; lane < 4; ++lane)
+        if (aBest[lane] < bestDistance || (aBest[lane] == bestDistance && aBestSlots[lane] < bestSlot))
+        {
+            bestDistance = aBest[lane];
+            bestSlot = aBestSlots[lane];
+        }// if
+#else
+    for (int i = begin; i < end; ++i)
+    {
+        int dr = m_vRG[i * 2] - r,
+            dg = m_vRG[i * 2 + 1] - g,
+            db = m_vB0[i * 2] - b;
+        int distance = dr * dr + dg * dg + db * db;
+
+        if (distance < bestDistance)
+        {
+            bestDistance = distance;
+            bestSlot = i;
+        }// if
+    }// for
+#endif
+
+    return m_vIndex[bestSlot];
+}// Nearest
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Index of the color nearest to every point of a cube, or -1.  The color
+//  whose farthest point of the cube is closest wins everywhere when no other
+//  candidate comes closer to the cube than that, or exactly as close with an
+//  earlier index.  Otherwise points of the cube may disagree; -1 is returned
+//  even if they happen not to, so the answer is never wrong, only sometimes
+//  left to Nearest.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ColorIndex::Cube_Nearest(int r, int g, int b, int size, std::vector<int>& vScratch) const
+{
+    int bucket = (((r >> c_gridShift) * c_gridSize) + (g >> c_gridShift)) * c_gridSize + (b >> c_gridShift);
+    int begin = m_vBucketStart[bucket],
+        end = m_vBucketStart[bucket + 1];
+    int aLow[3] = { r, g, b };
+
+    if (begin == end)
+        return -1;
+
+    // nearest distance of each candidate to the cube
+    vScratch.resize(end - begin);
+    int* aNearest = &vScratch[0];
+    int winner = -1,
+        limit = 0x7FFFFFFF;
+
+    for (int i = begin; i < end; ++i)
+    {
+        int aValue[3] = { m_vRG[i * 2], m_vRG[i * 2 + 1], m_vB0[i * 2] };
+        int nearest = 0,
+            farthest = 0;
+
+        for (int c = 0; c < 3; ++c)
+        {
+            int channelNearest, channelFarthest;
+            ChannelDistances(aValue[c], aLow[c], aLow[c] + size - 1, channelNearest, channelFarthest);
+            nearest += channelNearest;
+            farthest += channelFarthest;
+        }// for
+
+        aNearest[i - begin] = nearest;
+        if (farthest < limit)
+        {
+            limit = farthest;
+            winner = i;
+        }// if
+    }// for
+
+    for (int i = begin; i < end; ++i)
+    {
+        if (i == winner || m_vIndex[i] == m_vIndex[winner])
+            continue;
+
+        if (aNearest[i - begin] < limit || (aNearest[i - begin] == limit && m_vIndex[i] < m_vIndex[winner]))
+            return -1;
+    }// for
+
+    return m_vIndex[winner];
+}// Cube_Nearest
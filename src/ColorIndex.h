@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorIndex.h
+//
+//      Spatial index answering nearest palette color queries.  RGB space is
+//  cut into a grid of buckets, and each bucket keeps only the palette colors
+//  that can be nearest to some point inside it, so a query scans a handful of
+//  candidates whatever the palette size.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COLOR_INDEX_H_
+#define _COLOR_INDEX_H_
+
+#include <vector>
+
+class Palette;
+
+class ColorIndex
+{
+    // methods
+    public:
+        ColorIndex();
+
+        void Build(const Palette& palette);
+
+        // Index of the palette color nearest to the given color in squared RGB
+        // distance, ties going to the earlier color.  Channels are clamped to
+        // [0, 255] first, so perturbed colors from error diffusion may be passed
+        // directly.  Must not be called on an empty palette.
+        int  Nearest(int r, int g, int b) const;
+
+        // Index of the palette color nearest to every point of the cube of the
+        // given size with the given low corner, ties going to the earlier color,
+        // or -1 if the nearest color differs between points of the cube or the
+        // palette is empty.  The cube must lie within one bucket.  vScratch is
+        // working space, kept by the caller so it is allocated only once.
+        int  Cube_Nearest(int r, int g, int b, int size, std::vector<int>& vScratch) const;
+
+    // members
+    private:
+        // candidates of every bucket, in palette order, padded to groups of four:
+        //  m_vRG holds interleaved red and green, m_vB0 blue and zero, so a
+        //  single multiply-add gives two squared channel distances per candidate
+        std::vector<short>  m_vRG;
+        std::vector<short>  m_vB0;
+        std::vector<int>    m_vIndex;               // palette index of each candidate
+        std::vector<int>    m_vBucketStart;         // first candidate of each bucket, plus an end marker
+};// ColorIndex
+
+#endif // _COLOR_INDEX_H_
@@ -0,0 +1,772 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorQuant.cpp
+//
+//      Implementation of the color quantization building blocks.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ColorQuant.h"
+#include "Parallel.h"
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// constants
+const int   c_histogramGrain    = 1 << 16;      // minimum pixels per histogram thread
+const int   c_inverseGrain      = 1 << 10;      // minimum cells per inverse colormap thread
+const int   c_kMeansGrain       = 1 << 11;      // minimum occupied cells per k-means thread
+const int   c_mapGrain          = 1 << 16;      // minimum pixels per mapping thread
+const int   c_octreeDepth       = 8;            // leaves hold exact colors until reduced
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Count the RGBA pixels falling in each histogram cell.
+//
+///////////////////////////////////////////////////////////////////////////////
+void BuildColorHistogram(const unsigned char* rgba, int nPixels, unsigned int* aCounts)
+{
+    int nChunks = ChunkCount(0, nPixels, c_histogramGrain);
+    std::vector<unsigned int> vPartial((size_t)(nChunks - 1) * c_nColorCells, 0);
+
+    memset(aCounts, 0, c_nColorCells * sizeof(unsigned int));
+
+    ParallelChunks(0, nPixels, nChunks, [&](int chunk, int begin, int end)
+    {
+        unsigned int* aChunkCounts = chunk ? &vPartial[(size_t)(chunk - 1) * c_nColorCells] : aCounts;
+        const unsigned char* pixel = rgba + (size_t)begin * 4;
+
+        for (int i = begin; i < end; ++i, pixel += 4)
+            ++aChunkCounts[ColorCell(pixel[0], pixel[1], pixel[2])];
+    });
+
+    for (int chunk = 1; chunk < nChunks; ++chunk)
+    {
+        const unsigned int* aChunkCounts = &vPartial[(size_t)(chunk - 1) * c_nColorCells];
+        for (int cell = 0; cell < c_nColorCells; ++cell)
+            aCounts[cell] += aChunkCounts[cell];
+    }// for
+}// BuildColorHistogram
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Select up to maxColors of the most populated cells, most populated
+//  first.  Only the selected cells are sorted.
+//
+///////////////////////////////////////////////////////////////////////////////
+int SelectPopularCells(const unsigned int* aCounts, int maxColors, int* aCells)
+{
+    std::vector<int> vCells;
+    for (int cell = 0; cell < c_nColorCells; ++cell)
+        if (aCounts[cell])
+            vCells.push_back(cell);
+
+    int nSelected = Min((int)vCells.size(), maxColors);
+    std::partial_sort(vCells.begin(), vCells.begin() + nSelected, vCells.end(),
+                      [aCounts](int a, int b)
+                      { return aCounts[a] > aCounts[b] || (aCounts[a] == aCounts[b] && a < b); });
+
+    std::copy(vCells.begin(), vCells.begin() + nSelected, aCells);
+    return nSelected;
+}// SelectPopularCells
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a palette of the most populated cells, with its inverse colormap.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PopulosityPalette(const unsigned int* aCounts, int maxColors, Palette& palette)
+{
+    std::vector<int> vCells(maxColors);
+    int nColors = SelectPopularCells(aCounts, maxColors, &vCells[0]);
+
+    palette.Clear();
+    for (int i = 0; i < nColors; ++i)
+        palette.Add_Cell(vCells[i]);
+
+    palette.Build_Inverse();
+}// PopulosityPalette
+
+
+// channel value of the center of a histogram cell, channel 0 being red
+static inline int CellCenter(int cell, int channel)
+{
+    return (((cell >> (10 - 5 * channel)) & 0x1F) << 3) + 4;
+}// CellCenter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a palette by median cut.  The boxes are ranges of a compact list
+//  of the occupied histogram cells rather than lists of pixels.  The box with
+//  the longest side is split across that side at the median of its pixel
+//  count, found by accumulating cell counts in channel order.  Each palette
+//  color is the count-weighted mean of the cell centers in its box.
+//
+///////////////////////////////////////////////////////////////////////////////
+void MedianCutPalette(const unsigned int* aCounts, int maxColors, Palette& palette)
+{
+    struct Box
+    {
+        int begin, end;             // range of occupied cells
+        int longestSide;            // channel with the widest range
+        int length;                 // width of that range, in cells
+    };// Box
+
+    std::vector<int> vCells;
+    for (int cell = 0; cell < c_nColorCells; ++cell)
+        if (aCounts[cell])
+            vCells.push_back(cell);
+
+    // find the longest side of a box
+    auto Shrink = [&vCells](Box& box)
+    {
+        int aMin[3] = { 31, 31, 31 },
+            aMax[3] = { 0, 0, 0 };
+        for (int i = box.begin; i < box.end; ++i)
+            for (int c = 0; c < 3; ++c)
+            {
+                int value = (vCells[i] >> (10 - 5 * c)) & 0x1F;
+                aMin[c] = Min(aMin[c], value);
+                aMax[c] = Max(aMax[c], value);
+            }// for
+
+        box.longestSide = 0;
+        for (int c = 1; c < 3; ++c)
+            if (aMax[c] - aMin[c] > aMax[box.longestSide] - aMin[box.longestSide])
+                box.longestSide = c;
+        box.length = aMax[box.longestSide] - aMin[box.longestSide];
+    };
+
+    std::vector<Box> vBoxes;
+    if (!vCells.empty())
+    {
+        Box box = { 0, (int)vCells.size(), 0, 0 };
+        Shrink(box);
+        vBoxes.push_back(box);
+    }// if
+
+    while ((int)vBoxes.size() < maxColors)
+    {
+        // split the box with the longest side
+        int split = -1;
+        for (int i = 0; i < (int)vBoxes.size(); ++i)
+            if (vBoxes[i].length > 0 && (split < 0 || vBoxes[i].length > vBoxes[split].length))
+                split = i;
+        if (split < 0)
+            break;
+
+        Box& box = vBoxes[split];
+        int shift = 10 - 5 * box.longestSide;
+        std::sort(vCells.begin() + box.begin, vCells.begin() + box.end, [shift](int a, int b)
+                  {
+                      int valueA = (a >> shift) & 0x1F,
+                          valueB = (b >> shift) & 0x1F;
+                      return valueA < valueB || (valueA == valueB && a < b);
+                  });
+
+        unsigned long long total = 0;
+        for (int i = box.begin; i < box.end; ++i)
+            total += aCounts[vCells[i]];
+
+        // the lower half ends once it holds half the pixels, keeping both halves non-empty
+        unsigned long long count = 0;
+        int median = box.begin + 1;
+        for (; median < box.end - 1; ++median)
+            if ((count += aCounts[vCells[median - 1]]) * 2 >= total)
+                break;
+
+        Box lower = { box.begin, median, 0, 0 },
+            upper = { median, box.end, 0, 0 };
+        Shrink(lower);
+        Shrink(upper);
+        box = lower;
+        vBoxes.push_back(upper);
+    }// while
+
+    palette.Clear();
+    for (size_t i = 0; i < vBoxes.size(); ++i)
+    {
+        unsigned long long aSum[3] = { 0, 0, 0 },
+                           total = 0;
+        for (int j = vBoxes[i].begin; j < vBoxes[i].end; ++j)
+        {
+            unsigned int count = aCounts[vCells[j]];
+            for (int c = 0; c < 3; ++c)
+                aSum[c] += (unsigned long long)count * CellCenter(vCells[j], c);
+            total += count;
+        }// for
+
+        palette.Add_Color((unsigned char)((aSum[0] + total / 2) / total),
+                          (unsigned char)((aSum[1] + total / 2) / total),
+                          (unsigned char)((aSum[2] + total / 2) / total));
+    }// for
+}// MedianCutPalette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Refine a palette with k-means over the histogram.  Each round assigns
+//  every occupied cell, weighted by its count, to its nearest palette color
+//  through the spatial index, then moves each color to the weighted mean of
+//  its cells.  Assignment runs in parallel with per-thread sums which are
+//  merged afterwards.  Colors that attract no cells stay where they are, and
+//  the rounds stop early once no color moves.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RefinePalette(const unsigned int* aCounts, int nIterations, Palette& palette)
+{
+    struct Cluster
+    {
+        unsigned long long aSum[3];
+        unsigned long long count;
+    };// Cluster
+
+    int nColors = palette.Size();
+    if (!nColors)
+        return;
+
+    std::vector<int> vCells;
+    for (int cell = 0; cell < c_nColorCells; ++cell)
+        if (aCounts[cell])
+            vCells.push_back(cell);
+
+    int nCells = (int)vCells.size();
+    int nChunks = ChunkCount(0, nCells, c_kMeansGrain);
+    std::vector<Cluster> vClusters((size_t)nChunks * nColors);
+
+    for (int iteration = 0; iteration < nIterations; ++iteration)
+    {
+        palette.Build_Index();
+        std::fill(vClusters.begin(), vClusters.end(), Cluster());
+
+        ParallelChunks(0, nCells, nChunks, [&](int chunk, int begin, int end)
+        {
+            Cluster* aClusters = &vClusters[(size_t)chunk * nColors];
+            for (int i = begin; i < end; ++i)
+            {
+                int cell = vCells[i];
+                int r = CellCenter(cell, 0),
+                    g = CellCenter(cell, 1),
+                    b = CellCenter(cell, 2);
+
+                Cluster& cluster = aClusters[palette.Nearest(r, g, b)];
+                cluster.aSum[0] += (unsigned long long)aCounts[cell] * r;
+                cluster.aSum[1] += (unsigned long long)aCounts[cell] * g;
+                cluster.aSum[2] += (unsigned long long)aCounts[cell] * b;
+                cluster.count += aCounts[cell];
+            }// for
+        });
+
+        for (int chunk = 1; chunk < nChunks; ++chunk)
+            for (int i = 0; i < nColors; ++i)
+            {
+                const Cluster& partial = vClusters[(size_t)chunk * nColors + i];
+                for (int c = 0; c < 3; ++c)
+                    vClusters[i].aSum[c] += partial.aSum[c];
+                vClusters[i].count += partial.count;
+            }// for
+
+        Palette refined;
+        bool bMoved = false;
+        for (int i = 0; i < nColors; ++i)
+        {
+            const Cluster& cluster = vClusters[i];
+            Palette::Color color = palette[i];
+
+            if (cluster.count)
+            {
+                color.r = (unsigned char)((cluster.aSum[0] + cluster.count / 2) / cluster.count);
+                color.g = (unsigned char)((cluster.aSum[1] + cluster.count / 2) / cluster.count);
+                color.b = (unsigned char)((cluster.aSum[2] + cluster.count / 2) / cluster.count);
+            }// if
+
+            bMoved = bMoved || color.r != palette[i].r || color.g != palette[i].g || color.b != palette[i].b;
+            refined.Add_Color(color.r, color.g, color.b);
+        }// for
+
+        palette = refined;
+        if (!bMoved)
+            break;
+    }// for
+
+    palette.Build_Inverse();
+}// RefinePalette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Start with no colors.
+//
+///////////////////////////////////////////////////////////////////////////////
+Palette::Palette() : m_bIndexed(false)
+{}// Palette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Remove all colors.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Palette::Clear()
+{
+    m_vColors.clear();
+    m_vInverse.clear();
+    m_bIndexed = false;
+}// Clear
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add a color.  The inverse colormap must be rebuilt afterwards.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Palette::Add_Color(unsigned char r, unsigned char g, unsigned char b)
+{
+    Color color = { r, g, b };
+    m_vColors.push_back(color);
+    m_vInverse.clear();
+    m_bIndexed = false;
+}// Add_Color
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add the lowest color of a histogram cell.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Palette::Add_Cell(int cell)
+{
+    Add_Color(((cell >> 10) & 0x1F) << 3, ((cell >> 5) & 0x1F) << 3, (cell & 0x1F) << 3);
+}// Add_Cell
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Index of the color nearest to the given one in squared RGB distance.
+//  Ties go to the earlier color.  Uses the spatial index once it has been
+//  built, otherwise scans the palette.
+//
+///////////////////////////////////////////////////////////////////////////////
+int Palette::Nearest(int r, int g, int b) const
+{
+    if (m_bIndexed)
+        return m_index.Nearest(r, g, b);
+
+    int nearest = 0,
+        minDistance = 0x7FFFFFFF;
+
+    for (int i = 0; i < (int)m_vColors.size(); ++i)
+    {
+        int dr = m_vColors[i].r - r,
+            dg = m_vColors[i].g - g,
+            db = m_vColors[i].b - b;
+        int distance = dr * dr + dg * dg + db * db;
+
+        if (distance < minDistance)
+        {
+            minDistance = distance;
+            nearest = i;
+        }// if
+    }// for
+
+    return nearest;
+}// Nearest
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the spatial index answering Nearest queries.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Palette::Build_Index()
+{
+    m_index.Build(*this);
+    m_bIndexed = true;
+}// Build_Index
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the inverse colormap: for every 5-5-5 histogram cell, the palette
+//  color nearest to all the colors in it, found among the candidates of the
+//  spatial index.  Cells whose colors have different nearest colors, such as
+//  those between two palette colors, are marked -1 and searched per pixel, so
+//  mapping is exactly the nearest color search.  The spatial index used to
+//  fill the table is kept for later queries.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Palette::Build_Inverse()
+{
+    Build_Index();
+    m_vInverse.resize(c_nColorCells);
+
+    // an empty palette, from an empty image, has no colors to map to
+    if (m_vColors.empty())
+    {
+        std::fill(m_vInverse.begin(), m_vInverse.end(), (short)-1);
+        return;
+    }// if
+
+    ParallelFor(0, c_nColorCells, c_inverseGrain, [this](int begin, int end)
+    {
+        std::vector<int> vScratch;
+        for (int cell = begin; cell < end; ++cell)
+            m_vInverse[cell] = (short)m_index.Cube_Nearest(((cell >> 10) & 0x1F) << 3,
+                                                           ((cell >> 5) & 0x1F) << 3,
+                                                           (cell & 0x1F) << 3, 8, vScratch);
+    });
+}// Build_Inverse
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace the color of each RGBA pixel by its palette color through the
+//  inverse colormap, searching only in cells it leaves open.  Alpha is left
+//  unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void Palette::Map(unsigned char* rgba, int nPixels) const
+{
+    ParallelFor(0, nPixels, c_mapGrain, [this, rgba](int begin, int end)
+    {
+        unsigned char* pixel = rgba + (size_t)begin * 4;
+        for (int i = begin; i < end; ++i, pixel += 4)
+        {
+            int index = m_vInverse[ColorCell(pixel[0], pixel[1], pixel[2])];
+            if (index < 0)
+                index = m_index.Nearest(pixel[0], pixel[1], pixel[2]);
+
+            const Color& color = m_vColors[index];
+            pixel[0] = color.r;
+            pixel[1] = color.g;
+            pixel[2] = color.b;
+        }// for
+    });
+}// Map
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  The node pool is allocated here and never grows: with at
+//  most maxColors + 1 leaves, each below at most c_octreeDepth other nodes, the
+//  tree can never need more nodes than that.
+//
+///////////////////////////////////////////////////////////////////////////////
+OctreeQuantizer::OctreeQuantizer(int maxColors) : m_maxColors(Max(Min(maxColors, 256), 1)), m_nLeaves(0)
+{
+    m_vNodes.resize(1 + (m_maxColors + 1) * c_octreeDepth);
+
+    m_freeNode = -1;
+    for (int i = (int)m_vNodes.size() - 1; i >= 0; --i)
+    {
+        m_vNodes[i].next = m_freeNode;
+        m_freeNode = i;
+    }// for
+
+    for (int level = 0; level < c_octreeDepth; ++level)
+        m_aReducible[level] = -1;
+
+    New_Node(0);    // the root
+}// OctreeQuantizer
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take a node for the given level from the pool and clear it.  Nodes on
+//  the last level are leaves, the others are internal and become reducible.
+//
+///////////////////////////////////////////////////////////////////////////////
+int OctreeQuantizer::New_Node(int level)
+{
+    int index = m_freeNode;
+    m_freeNode = m_vNodes[index].next;
+
+    Node& node = m_vNodes[index];
+    node.aSum[0] = node.aSum[1] = node.aSum[2] = 0;
+    node.count = 0;
+    for (int i = 0; i < 8; ++i)
+        node.aChildren[i] = -1;
+    node.paletteIndex = 0;
+    node.bLeaf = level == c_octreeDepth;
+
+    if (node.bLeaf)
+        ++m_nLeaves;
+    else
+    {
+        node.next = m_aReducible[level];
+        m_aReducible[level] = index;
+    }// else
+
+    return index;
+}// New_Node
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Merge the children of the most recently created node on the deepest
+//  level that has internal nodes, turning it into a leaf and returning the
+//  children to the pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OctreeQuantizer::Reduce()
+{
+    int level = c_octreeDepth - 1;
+    while (level > 0 && m_aReducible[level] < 0)
+        --level;
+
+    int index = m_aReducible[level];
+    if (index < 0)
+        return;
+
+    Node& node = m_vNodes[index];
+    m_aReducible[level] = node.next;
+
+    int nChildren = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        int child = node.aChildren[i];
+        if (child < 0)
+            continue;
+
+        // the deepest reducible level is chosen, so every child is a leaf
+        for (int c = 0; c < 3; ++c)
+            node.aSum[c] += m_vNodes[child].aSum[c];
+        node.count += m_vNodes[child].count;
+
+        m_vNodes[child].next = m_freeNode;
+        m_freeNode = child;
+        node.aChildren[i] = -1;
+        ++nChildren;
+    }// for
+
+    node.bLeaf = true;
+    m_nLeaves -= nChildren - 1;
+}// Reduce
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Stream pixels into the tree in a single pass.  Whenever the tree holds
+//  more leaves than colors, leaves are merged, so memory stays bounded no
+//  matter how many pixels are added.  May be called repeatedly, for instance
+//  once per band of rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OctreeQuantizer::Add_Pixels(const unsigned char* rgba, int nPixels)
+{
+    for (int i = 0; i < nPixels; ++i, rgba += 4)
+    {
+        int index = 0;
+        for (int level = 0; !m_vNodes[index].bLeaf; ++level)
+        {
+            int shift = 7 - level;
+            int octant = (((rgba[0] >> shift) & 1) << 2) | (((rgba[1] >> shift) & 1) << 1) | ((rgba[2] >> shift) & 1);
+
+            int child = m_vNodes[index].aChildren[octant];
+            if (child < 0)
+            {
+                child = New_Node(level + 1);
+                m_vNodes[index].aChildren[octant] = child;
+            }// if
+            index = child;
+        }// for
+
+        Node& leaf = m_vNodes[index];
+        leaf.aSum[0] += rgba[0];
+        leaf.aSum[1] += rgba[1];
+        leaf.aSum[2] += rgba[2];
+        ++leaf.count;
+
+        while (m_nLeaves > m_maxColors)
+            Reduce();
+    }// for
+}// Add_Pixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Give every leaf below the given node a palette entry holding the mean
+//  color of its pixels.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OctreeQuantizer::Assign_Leaves(int index)
+{
+    Node& node = m_vNodes[index];
+    if (node.bLeaf)
+    {
+        if (!node.count)
+            return;
+
+        node.paletteIndex = m_palette.Size();
+        m_palette.Add_Color((unsigned char)((node.aSum[0] + node.count / 2) / node.count),
+                            (unsigned char)((node.aSum[1] + node.count / 2) / node.count),
+                            (unsigned char)((node.aSum[2] + node.count / 2) / node.count));
+        return;
+    }// if
+
+    for (int i = 0; i < 8; ++i)
+        if (node.aChildren[i] >= 0)
+            Assign_Leaves(node.aChildren[i]);
+}// Assign_Leaves
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build the palette from the leaves once all pixels have been added.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OctreeQuantizer::Build_Palette()
+{
+    m_palette.Clear();
+    Assign_Leaves(0);
+    m_palette.Build_Inverse();
+}// Build_Palette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace each pixel by the color of the leaf it falls in.  Colors that
+//  were never added to the tree fall back to the nearest palette color.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OctreeQuantizer::Map(unsigned char* rgba, int nPixels) const
+{
+    if (!m_palette.Size())
+        return;
+
+    ParallelFor(0, nPixels, c_mapGrain, [this, rgba](int begin, int end)
+    {
+        unsigned char* pixel = rgba + (size_t)begin * 4;
+        for (int i = begin; i < end; ++i, pixel += 4)
+        {
+            int index = 0;
+            for (int level = 0; index >= 0 && !m_vNodes[index].bLeaf; ++level)
+            {
+                int shift = 7 - level;
+                index = m_vNodes[index].aChildren[(((pixel[0] >> shift) & 1) << 2) |
+                                                  (((pixel[1] >> shift) & 1) << 1) |
+                                                  ((pixel[2] >> shift) & 1)];
+            }// for
+
+            int entry = (index >= 0 && m_vNodes[index].count) ? m_vNodes[index].paletteIndex
+                                                               : m_palette.Nearest(pixel[0], pixel[1], pixel[2]);
+            const Palette::Color& color = m_palette[entry];
+            pixel[0] = color.r;
+            pixel[1] = color.g;
+            pixel[2] = color.b;
+        }// for
+    });
+}// Map
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Start with no samples.
+//
+///////////////////////////////////////////////////////////////////////////////
+PaletteCache::PaletteCache() : m_vCounts(c_nColorCells, 0), m_bHasSamples(false)
+{}// PaletteCache
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Forget all samples and the cached palette.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PaletteCache::Reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::fill(m_vCounts.begin(), m_vCounts.end(), 0);
+    m_bHasSamples = false;
+    m_pPalette.reset();
+}// Reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add the histogram of the given pixels to the shared one.  The palette
+//  is rebuilt from the updated histogram the next time it is needed, so
+//  frames can be sampled up front or folded in incrementally.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PaletteCache::Add_Sample(const unsigned char* rgba, int nPixels)
+{
+    std::vector<unsigned int> vCounts(c_nColorCells);
+    BuildColorHistogram(rgba, nPixels, &vCounts[0]);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (int cell = 0; cell < c_nColorCells; ++cell)
+        m_vCounts[cell] += vCounts[cell];
+    m_bHasSamples = true;
+    m_pPalette.reset();
+}// Add_Sample
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add the given pixels as the first sample if nothing has been sampled
+//  since the last reset, and return whether they were added.  The check and
+//  the sample are one step under the lock, so when several frames race to
+//  seed the palette exactly one of them does.  The histogram is built outside
+//  the lock and the check repeated before it is stored.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool PaletteCache::Sample_If_Empty(const unsigned char* rgba, int nPixels)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_bHasSamples)
+            return false;
+    }
+
+    std::vector<unsigned int> vCounts(c_nColorCells);
+    BuildColorHistogram(rgba, nPixels, &vCounts[0]);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_bHasSamples)
+        return false;
+
+    // without samples the shared histogram is all zero
+    m_vCounts.swap(vCounts);
+    m_bHasSamples = true;
+    m_pPalette.reset();
+    return true;
+}// Sample_If_Empty
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Get the populosity palette of every sample so far, with its inverse
+//  colormap.  It is built once and then shared until the next sample, so
+//  every frame mapped with it gets the same colors.
+//
+///////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<const Palette> PaletteCache::Get_Palette()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_pPalette)
+    {
+        std::shared_ptr<Palette> pPalette = std::make_shared<Palette>();
+        PopulosityPalette(&m_vCounts[0], 256, *pPalette);
+        m_pPalette = pPalette;
+    }// if
+
+    return m_pPalette;
+}// Get_Palette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The process-wide cache used by the shared palette script commands.
+//
+///////////////////////////////////////////////////////////////////////////////
+PaletteCache& PaletteCache::Shared()
+{
+    static PaletteCache cache;
+    return cache;
+}// Shared
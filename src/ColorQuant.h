@@ -0,0 +1,176 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ColorQuant.h
+//
+//      Building blocks shared by the color quantizers.  Colors are binned into
+//  a 5-5-5 histogram of 32768 cells.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COLOR_QUANT_H_
+#define _COLOR_QUANT_H_
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "ColorIndex.h"
+
+const int   c_nColorCells   = 1 << 15;      // number of 5-5-5 histogram cells
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Histogram cell of a color, keeping the top 5 bits of each channel.
+//
+///////////////////////////////////////////////////////////////////////////////
+inline int ColorCell(unsigned char r, unsigned char g, unsigned char b)
+{
+    return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+}// ColorCell
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Count the RGBA pixels falling in each histogram cell.  aCounts must
+//  hold c_nColorCells entries.  Each thread fills a private histogram and the
+//  histograms are summed at the end.
+//
+///////////////////////////////////////////////////////////////////////////////
+void BuildColorHistogram(const unsigned char* rgba, int nPixels, unsigned int* aCounts);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Select up to maxColors of the most populated cells into aCells, most
+//  populated first; ties go to the lower cell index.  Return the number of
+//  cells selected.
+//
+///////////////////////////////////////////////////////////////////////////////
+int SelectPopularCells(const unsigned int* aCounts, int maxColors, int* aCells);
+
+
+class Palette
+{
+    // types
+    public:
+        struct Color
+        {
+            unsigned char r, g, b;
+        };// Color
+
+    // methods
+    public:
+        Palette();
+
+        void Clear();
+        void Add_Color(unsigned char r, unsigned char g, unsigned char b);
+        void Add_Cell(int cell);                            // add the lowest color of a histogram cell
+        int  Size() const                           { return (int)m_vColors.size(); }
+        const Color& operator [](int i) const       { return m_vColors[i]; }
+
+        int  Nearest(int r, int g, int b) const;            // index of the nearest color
+
+        void Build_Index();                                 // speeds up Nearest
+        void Build_Inverse();                               // builds the index too; must be called before Map
+        void Map(unsigned char* rgba, int nPixels) const;   // replace pixels by their palette color
+
+
+    // members
+    private:
+        std::vector<Color>          m_vColors;              // at most 256 colors
+        ColorIndex                  m_index;                // nearest color search structure
+        bool                        m_bIndexed;             // whether m_index matches the colors
+        std::vector<short>          m_vInverse;             // nearest color index of each histogram cell, or -1 to search
+};// Palette
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a palette of the maxColors most populated cells, with its inverse
+//  colormap.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PopulosityPalette(const unsigned int* aCounts, int maxColors, Palette& palette);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Build a palette of up to maxColors colors by median cut over the
+//  histogram.
+//
+///////////////////////////////////////////////////////////////////////////////
+void MedianCutPalette(const unsigned int* aCounts, int maxColors, Palette& palette);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Refine a palette with up to nIterations rounds of k-means (Lloyd's
+//  algorithm) over the histogram, then rebuild its inverse colormap.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RefinePalette(const unsigned int* aCounts, int nIterations, Palette& palette);
+
+
+class OctreeQuantizer
+{
+    // methods
+    public:
+        OctreeQuantizer(int maxColors);
+
+        void Add_Pixels(const unsigned char* rgba, int nPixels);    // stream pixels into the tree
+        void Build_Palette();                                       // call once all pixels are added
+        void Map(unsigned char* rgba, int nPixels) const;           // replace pixels by their leaf color
+
+        const Palette& Get_Palette() const          { return m_palette; }
+
+    private:
+        int  New_Node(int level);
+        void Reduce();                                  // merge the children of the deepest reducible node
+        void Assign_Leaves(int node);
+
+    // types
+    private:
+        struct Node
+        {
+            unsigned long long  aSum[3];            // channel sums of the pixels in this node
+            unsigned long long  count;              // number of pixels in this node
+            int                 aChildren[8];       // child per octant, or -1
+            int                 next;               // next reducible node on the level, or next free node
+            int                 paletteIndex;
+            bool                bLeaf;
+        };// Node
+
+    // members
+    private:
+        int                 m_maxColors;
+        std::vector<Node>   m_vNodes;               // fixed pool, sized once in the constructor
+        int                 m_freeNode;             // head of the free list
+        int                 m_aReducible[8];        // per level list of internal nodes
+        int                 m_nLeaves;
+        Palette             m_palette;
+};// OctreeQuantizer
+
+
+class PaletteCache
+{
+    // methods
+    public:
+        PaletteCache();
+
+        void Reset();                                               // forget all samples
+        void Add_Sample(const unsigned char* rgba, int nPixels);    // add pixels to the shared histogram
+        bool Sample_If_Empty(const unsigned char* rgba, int nPixels);   // add them only as the first sample
+
+        std::shared_ptr<const Palette> Get_Palette();               // built on first use after a sample
+
+        static PaletteCache& Shared();                              // the process-wide cache
+
+    // members
+    private:
+        std::mutex                      m_mutex;
+        std::vector<unsigned int>       m_vCounts;                  // histogram of every sample so far
+        bool                            m_bHasSamples;
+        std::shared_ptr<const Palette>  m_pPalette;                 // NULL until built
+};// PaletteCache
+
+#endif // _COLOR_QUANT_H_
@@ -0,0 +1,794 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolution.cpp
+//
+//      Implementation of the convolution filters.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Convolution.h"
+#include "Parallel.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#ifdef HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
+// constants
+const int   c_convolveGrain     = 32;           // minimum rows per convolution thread
+const int   c_bandKernels       = 4;            // minimum kernel sizes of rows per convolution band
+const int   c_recursiveGrain    = 64;           // minimum columns per recursive filter thread
+const int   c_transposeBlock    = 16;           // pixels per side of a transposed block
+
+
+enum EFilterOutput              // what a convolution stores
+{
+    OUTPUT_LOW_PASS,            // the filtered pixel
+    OUTPUT_EDGE,                // source minus filtered, clamped at zero
+    OUTPUT_ENHANCE              // source plus the signed edge response, saturating
+};// EFilterOutput
+
+
+// edge mode shared by all filters
+static std::atomic<int> s_edgeMode(EDGE_RENORMALISE);
+
+// script names, in EEdgeMode order
+const char  c_asEdgeModes[][16]     = { "renormalise", "clamp", "mirror", "wrap" };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+void SetEdgeMode(EEdgeMode mode)
+{
+    s_edgeMode.store(mode, std::memory_order_relaxed);
+}// SetEdgeMode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Current edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+EEdgeMode CurrentEdgeMode()
+{
+    return (EEdgeMode)s_edgeMode.load(std::memory_order_relaxed);
+}// CurrentEdgeMode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look up an edge mode by its script name.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FindEdgeMode(const char* sName, EEdgeMode& mode)
+{
+    for (int m = 0; m < NUM_EDGE_MODES; ++m)
+        if (!strcmp(sName, c_asEdgeModes[m]))
+        {
+            mode = (EEdgeMode)m;
+            return true;
+        }// if
+
+    return false;
+}// FindEdgeMode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Position inside [0, n) that tap position t reads in the given mode, or
+//  -1 if the tap is skipped.  Only border pixels call this.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int EdgeIndex(int t, int n, EEdgeMode mode)
+{
+    if (t >= 0 && t < n)
+        return t;
+
+    switch (mode)
+    {
+        case EDGE_CLAMP:
+            return (t < 0) ? 0 : n - 1;
+
+        case EDGE_MIRROR:
+        {
+            // reflections repeat with period 2 (n - 1)
+            if (n == 1)
+                return 0;
+            int period = 2 * (n - 1);
+            t = abs(t) % period;
+            return (t < n) ? t : period - t;
+        }// EDGE_MIRROR
+
+        case EDGE_WRAP:
+            return (t % n + n) % n;
+
+        default:
+            return -1;
+    }// switch
+}// EdgeIndex
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Weight of the taps used at each position along an axis of n pixels:
+//  the full kernel weight unless renormalising.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AxisWeights(int n, const int* aWeights, int size, EEdgeMode mode, std::vector<uint32_t>& vAxis)
+{
+    int radius = size / 2;
+
+    vAxis.assign(n, 0);
+    for (int x = 0; x < n; ++x)
+        for (int k = 0; k < size; ++k)
+            if (EdgeIndex(x + k - radius, n, mode) >= 0)
+                vAxis[x] += aWeights[k];
+}// AxisWeights
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Weighted sum of the channels of some pixels.  With SSE2 each pixel is
+//  widened to 16 bit lanes interleaved with zeros, so one multiply-add by
+//  the weight gives its four 32 bit products.  Four sums are stored per
+//  pixel; the alpha sum is unused.
+//
+///////////////////////////////////////////////////////////////////////////////
+class PixelSum
+{
+    // methods
+    public:
+#ifdef HAVE_SSE2
+        PixelSum() : m_sum(_mm_setzero_si128()) {}
+
+        void Add(const unsigned char* pixel, int weight)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i value = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int*)pixel), zero), zero);
+            m_sum = _mm_add_epi32(m_sum, _mm_madd_epi16(value, _mm_set1_epi32(weight)));
+        }// Add
+
+        void Store(uint32_t* aSums) const   { _mm_storeu_si128((__m128i*)aSums, m_sum); }
+#else
+        PixelSum()                          { m_aSum[0] = m_aSum[1] = m_aSum[2] = 0; }
+
+        void Add(const unsigned char* pixel, int weight)
+        {
+            m_aSum[0] += pixel[0] * weight;
+            m_aSum[1] += pixel[1] * weight;
+            m_aSum[2] += pixel[2] * weight;
+        }// Add
+
+        void Store(uint32_t* aSums) const
+        {
+            aSums[0] = m_aSum[0];
+            aSums[1] = m_aSum[1];
+            aSums[2] = m_aSum[2];
+        }// Store
+#endif
+
+    // members
+    private:
+#ifdef HAVE_SSE2
+        __m128i     m_sum;
+#else
+        uint32_t    m_aSum[3];
+#endif
+};// PixelSum
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Weighted sum of the taps of a border pixel, each mapped through the
+//  edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ConvolveBorderPixel(const unsigned char* row, uint32_t* aSums, int x, int width,
+                                const int* aWeights, int size, EEdgeMode mode)
+{
+    PixelSum sum;
+
+    for (int n = 0; n < size; ++n)
+    {
+        int t = EdgeIndex(x + n - size / 2, width, mode);
+        if (t >= 0)
+            sum.Add(row + t * 4, aWeights[n]);
+    }// for
+
+    sum.Store(aSums + x * 4);
+}// ConvolveBorderPixel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Horizontal pass over one row: the weighted sum of the taps of every
+//  channel.  Interior pixels, whose taps all fall inside the row, run
+//  without any checks; only the radius pixels at either end map their taps
+//  through the edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ConvolveRow(const unsigned char* row, uint32_t* aSums, int width, const int* aWeights, int size,
+                        EEdgeMode mode)
+{
+    int radius = size / 2;
+    int interiorBegin = Min(radius, width);
+    int interiorEnd = Max(width - radius, interiorBegin);
+
+    for (int x = 0; x < interiorBegin; ++x)
+        ConvolveBorderPixel(row, aSums, x, width, aWeights, size, mode);
+
+    for (int x = interiorBegin; x < interiorEnd; ++x)
+    {
+        PixelSum sum;
+        const unsigned char* pixel = row + (x - radius) * 4;
+
+        for (int n = 0; n < size; ++n, pixel += 4)
+            sum.Add(pixel, aWeights[n]);
+        sum.Store(aSums + x * 4);
+    }// for
+
+    for (int x = interiorEnd; x < width; ++x)
+        ConvolveBorderPixel(row, aSums, x, width, aWeights, size, mode);
+}// ConvolveRow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add weight times the row of sums to the accumulator.  SSE2 has no 32
+//  bit low multiply, so the even and odd lanes are multiplied as 64 bit
+//  products and their low halves put back together; the wrap around is the
+//  same as for plain unsigned arithmetic.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void AccumulateRow(uint32_t* aTotals, const uint32_t* aRow, uint32_t weight, size_t count)
+{
+    size_t k = 0;
+
+#ifdef HAVE_SSE2
+    const __m128i factor = _mm_set1_epi32((int)weight);
+
+    for (; k + 4 <= count; k += 4)
+    {
+        __m128i value = _mm_loadu_si128((const __m128i*)(aRow + k));
+        __m128i even = _mm_mul_epu32(value, factor);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(value, 32), factor);
+        __m128i product = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                             _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+
+        __m128i* total = (__m128i*)(aTotals + k);
+        _mm_storeu_si128(total, _mm_add_epi32(_mm_loadu_si128(total), product));
+    }// for
+#endif
+
+    for (; k < count; ++k)
+        aTotals[k] += aRow[k] * weight;
+}// AccumulateRow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Turn a row of filtered pixels, rounded up, into the edge response of
+//  the source row, in place: source minus filtered, clamped at zero.  With
+//  the filtered value rounded up that is the exact source minus convolution
+//  truncated, where the rounded down value would bias it up by one.  To
+//  enhance, add the signed response back onto the source instead,
+//  2 source - filtered, the exact value rounded down.  With SSE2 that is saturating byte arithmetic on four pixels at once: the
+//  positive and negative parts of the response are the two saturated
+//  differences, and at most one of them is nonzero.  Alpha is copied from
+//  the source.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void HighPassRow(const unsigned char* in, unsigned char* out, int width, bool bEnhance)
+{
+    int x = 0;
+
+#ifdef HAVE_SSE2
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i source = _mm_loadu_si128((const __m128i*)(in + x * 4));
+        __m128i filtered = _mm_loadu_si128((const __m128i*)(out + x * 4));
+        __m128i edge = _mm_subs_epu8(source, filtered);
+
+        if (bEnhance)
+            edge = _mm_subs_epu8(_mm_adds_epu8(source, edge), _mm_subs_epu8(filtered, source));
+
+        _mm_storeu_si128((__m128i*)(out + x * 4), _mm_or_si128(_mm_andnot_si128(alpha, edge), _mm_and_si128(alpha, source)));
+    }// for
+#endif
+
+    for (; x < width; ++x)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            int edge = in[x * 4 + c] - out[x * 4 + c];
+            out[x * 4 + c] = static_cast<unsigned char>(bEnhance ? Min(Max(in[x * 4 + c] + edge, 0), 255)
+                                                                 : Max(edge, 0));
+        }// for
+        out[x * 4 + 3] = in[x * 4 + 3];
+    }// for
+}// HighPassRow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve in bands of rows.  Each band keeps the horizontal sums of
+//  recent source rows in a ring of size rows, slot y % size holding row y,
+//  and output rows are the weighted sum of the rows their taps map to.  In
+//  the interior each source row is filtered horizontally once per band; rows
+//  the edge mode maps from elsewhere are filtered when first needed.  When
+//  renormalising, the weight of the taps used at a pixel is the product of
+//  the in-bounds weights along each axis, which matches the 2D filter.  For
+//  a high pass each output row is turned into the edge response while it is
+//  still in cache.  A band filters again the size - 1 rows it shares with the
+//  band above, so bands are at least c_bandKernels kernels tall to keep that
+//  below a quarter of the horizontal work.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void ConvolveBands(const unsigned char* source, unsigned char* target, int width, int height,
+                          const int* aWeights, int size, EEdgeMode mode, EFilterOutput output)
+{
+    int radius = size / 2;
+
+    std::vector<uint32_t> vColumnWeights, vRowWeights;
+    AxisWeights(width, aWeights, size, mode, vColumnWeights);
+    AxisWeights(height, aWeights, size, mode, vRowWeights);
+
+    ParallelFor(0, height, Max(c_convolveGrain, c_bandKernels * size), [&](int begin, int end)
+    {
+        size_t                  rowSize = (size_t)width * 4;
+        std::vector<uint32_t>   vRing(size * rowSize);
+        std::vector<int>        vRingRows(size, -1);        // source row held by each slot
+        std::vector<uint32_t>   vSums(rowSize);
+
+        for (int i = begin; i < end; ++i)
+        {
+            // vertical pass over the rows the taps read
+            std::fill(vSums.begin(), vSums.end(), 0);
+            for (int m = 0; m < size; ++m)
+            {
+                int y = EdgeIndex(i + m - radius, height, mode);
+                if (y < 0)
+                    continue;
+
+                uint32_t* aRow = &vRing[(y % size) * rowSize];
+                if (vRingRows[y % size] != y)
+                {
+                    ConvolveRow(source + (size_t)y * width * 4, aRow, width, aWeights, size, mode);
+                    vRingRows[y % size] = y;
+                }// if
+
+                AccumulateRow(&vSums[0], aRow, aWeights[m], rowSize);
+            }// for
+
+            const unsigned char*    in = source + (size_t)i * width * 4;
+            unsigned char*          out = target + (size_t)i * width * 4;
+            if (output == OUTPUT_LOW_PASS)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    uint32_t count = vColumnWeights[x] * vRowWeights[i];
+
+                    out[x * 4 + 0] = static_cast<unsigned char>(vSums[x * 4 + 0] / count);
+                    out[x * 4 + 1] = static_cast<unsigned char>(vSums[x * 4 + 1] / count);
+                    out[x * 4 + 2] = static_cast<unsigned char>(vSums[x * 4 + 2] / count);
+                    out[x * 4 + 3] = in[x * 4 + 3];
+                }// for
+            }// if
+            else
+            {
+                // the filtered value rounded up, so that the source minus it is
+                // the exact response truncated
+                for (int x = 0; x < width; ++x)
+                {
+                    uint32_t count = vColumnWeights[x] * vRowWeights[i];
+
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        uint32_t quotient = vSums[x * 4 + c] / count;
+                        out[x * 4 + c] = static_cast<unsigned char>(quotient + (quotient * count != vSums[x * 4 + c]));
+                    }// for
+                }// for
+
+                HighPassRow(in, out, width, output == OUTPUT_ENHANCE);
+            }// else
+        }// for
+    });
+}// ConvolveBands
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve with the outer product of the 1D kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ConvolveSeparable(const unsigned char* source, unsigned char* target, int width, int height,
+                       const int* aWeights, int size, EEdgeMode mode)
+{
+    ConvolveBands(source, target, width, height, aWeights, size, mode, OUTPUT_LOW_PASS);
+}// ConvolveSeparable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Edge response, or the source enhanced by it, in the same pass as the
+//  convolution it is taken from.
+//
+///////////////////////////////////////////////////////////////////////////////
+void HighPassSeparable(const unsigned char* source, unsigned char* target, int width, int height,
+                       const int* aWeights, int size, EEdgeMode mode, bool bEnhance)
+{
+    ConvolveBands(source, target, width, height, aWeights, size, mode, bEnhance ? OUTPUT_ENHANCE : OUTPUT_EDGE);
+}// HighPassSeparable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Running sums of the color channels of a window.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct WindowSum
+{
+    WindowSum() : r(0), g(0), b(0) {}
+
+    void Add(const unsigned char* pixel)        { r += pixel[0]; g += pixel[1]; b += pixel[2]; }
+    void Subtract(const unsigned char* pixel)   { r -= pixel[0]; g -= pixel[1]; b -= pixel[2]; }
+    void Store(uint32_t* aSums) const           { aSums[0] = r; aSums[1] = g; aSums[2] = b; }
+
+    uint32_t    r, g, b;
+};// WindowSum
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Move the window to border pixel x, mapping the pixels entering and
+//  leaving it through the edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void SlideBorder(const unsigned char* row, WindowSum& sum, int x, int width, int radius, EEdgeMode mode)
+{
+    int enter = EdgeIndex(x + radius, width, mode);
+    int leave = EdgeIndex(x - radius - 1, width, mode);
+
+    if (enter >= 0)
+        sum.Add(row + enter * 4);
+    if (leave >= 0)
+        sum.Subtract(row + leave * 4);
+}// SlideBorder
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Sums of the color channels over a sliding window of the row: the
+//  window gains the pixel entering on the right and loses the one leaving on
+//  the left as it moves.  Only near the ends do those pixels go through the
+//  edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void BoxRow(const unsigned char* row, uint32_t* aSums, int width, int radius, EEdgeMode mode)
+{
+    WindowSum   sum;
+    int         interiorBegin = Min(radius + 1, width);
+    int         interiorEnd = Max(width - radius, interiorBegin);
+
+    // window of the pixel before the first one
+    for (int t = -radius - 1; t < radius; ++t)
+    {
+        int x = EdgeIndex(t, width, mode);
+        if (x >= 0)
+            sum.Add(row + x * 4);
+    }// for
+
+    for (int x = 0; x < interiorBegin; ++x)
+    {
+        SlideBorder(row, sum, x, width, radius, mode);
+        sum.Store(aSums + x * 3);
+    }// for
+
+    for (int x = interiorBegin; x < interiorEnd; ++x)
+    {
+        sum.Add(row + (x + radius) * 4);
+        sum.Subtract(row + (x - radius - 1) * 4);
+        sum.Store(aSums + x * 3);
+    }// for
+
+    for (int x = interiorEnd; x < width; ++x)
+    {
+        SlideBorder(row, sum, x, width, radius, mode);
+        sum.Store(aSums + x * 3);
+    }// for
+}// BoxRow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter in bands of rows.  Each band keeps the sums of the row
+//  window over the column window; moving down a row adds the row sums of the
+//  row entering the window and subtracts those of the row leaving it, which
+//  are recomputed rather than stored so memory stays independent of the
+//  radius.  A band starts by summing the 2 radius + 1 rows of its first
+//  window, so bands are at least c_bandKernels windows tall to keep that to
+//  about an eighth of the two row sums per row that follow.
+//
+///////////////////////////////////////////////////////////////////////////////
+void BoxFilter(const unsigned char* source, unsigned char* target, int width, int height, int radius,
+               EEdgeMode mode)
+{
+    // taps used along each axis
+    std::vector<uint32_t> vColumnCounts(width), vRowCounts(height);
+    for (int x = 0; x < width; ++x)
+        vColumnCounts[x] = (mode == EDGE_RENORMALISE) ? Min(x + radius, width - 1) - Max(x - radius, 0) + 1 : 2 * radius + 1;
+    for (int y = 0; y < height; ++y)
+        vRowCounts[y] = (mode == EDGE_RENORMALISE) ? Min(y + radius, height - 1) - Max(y - radius, 0) + 1 : 2 * radius + 1;
+
+    ParallelFor(0, height, Max(c_convolveGrain, c_bandKernels * (2 * radius + 1)), [&](int begin, int end)
+    {
+        size_t                  rowSize = (size_t)width * 3;
+        std::vector<uint32_t>   vWindow(rowSize, 0);
+        std::vector<uint32_t>   vRow(rowSize);
+
+        // window of the row before the first one
+        for (int t = begin - radius - 1; t < begin + radius; ++t)
+        {
+            int y = EdgeIndex(t, height, mode);
+            if (y < 0)
+                continue;
+
+            BoxRow(source + (size_t)y * width * 4, &vRow[0], width, radius, mode);
+            for (size_t k = 0; k < rowSize; ++k)
+                vWindow[k] += vRow[k];
+        }// for
+
+        for (int i = begin; i < end; ++i)
+        {
+            int enter = EdgeIndex(i + radius, height, mode);
+            int leave = EdgeIndex(i - radius - 1, height, mode);
+
+            if (enter >= 0)
+            {
+                BoxRow(source + (size_t)enter * width * 4, &vRow[0], width, radius, mode);
+                for (size_t k = 0; k < rowSize; ++k)
+                    vWindow[k] += vRow[k];
+            }// if
+            if (leave >= 0)
+            {
+                BoxRow(source + (size_t)leave * width * 4, &vRow[0], width, radius, mode);
+                for (size_t k = 0; k < rowSize; ++k)
+                    vWindow[k] -= vRow[k];
+            }// if
+
+            const unsigned char*    in = source + (size_t)i * width * 4;
+            unsigned char*          out = target + (size_t)i * width * 4;
+            for (int x = 0; x < width; ++x)
+            {
+                uint32_t count = vRowCounts[i] * vColumnCounts[x];
+
+                out[x * 4 + 0] = static_cast<unsigned char>(vWindow[x * 3 + 0] / count);
+                out[x * 4 + 1] = static_cast<unsigned char>(vWindow[x * 3 + 1] / count);
+                out[x * 4 + 2] = static_cast<unsigned char>(vWindow[x * 3 + 2] / count);
+                out[x * 4 + 3] = in[x * 4 + 3];
+            }// for
+        }// for
+    });
+}// BoxFilter
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Halve the image.  Only the top row and left column of the target reach
+//  past the border, since the taps of the last target pixel end at source
+//  pixel 2 (n / 2) - 1 <= n - 1; every other pixel takes all nine taps with
+//  a weight of 16 and no checks.  Target rows run in parallel bands.
+//
+///////////////////////////////////////////////////////////////////////////////
+void HalveImage(const unsigned char* source, unsigned char* target, int width, int height, EEdgeMode mode)
+{
+    static const int    aWeights[3] = { 1, 2, 1 };
+    int                 halfWidth = width / 2;
+    int                 halfHeight = height / 2;
+    size_t              stride = (size_t)width * 4;
+
+    ParallelRows(0, halfHeight, [=](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            unsigned char* out = target + (size_t)i * halfWidth * 4;
+
+            for (int j = 0; j < halfWidth; ++j, out += 4)
+            {
+                PixelSum    sum;
+                uint32_t    count = 0;
+                uint32_t    aSums[4];
+
+                if (i > 0 && j > 0)
+                {
+                    const unsigned char* pixel = source + (2 * i - 1) * stride + (2 * j - 1) * 4;
+
+                    for (int m = 0; m < 3; ++m, pixel += stride)
+                        for (int n = 0; n < 3; ++n)
+                            sum.Add(pixel + n * 4, aWeights[m] * aWeights[n]);
+                    count = 16;
+                }// if
+                else
+                {
+                    for (int m = 0; m < 3; ++m)
+                        for (int n = 0; n < 3; ++n)
+                        {
+                            int y = EdgeIndex(2 * i + m - 1, height, mode);
+                            int x = EdgeIndex(2 * j + n - 1, width, mode);
+                            if (y < 0 || x < 0)
+                                continue;
+
+                            sum.Add(source + y * stride + x * 4, aWeights[m] * aWeights[n]);
+                            count += aWeights[m] * aWeights[n];
+                        }// for
+                }// else
+
+                sum.Store(aSums);
+                out[0] = static_cast<unsigned char>(aSums[0] / count);
+                out[1] = static_cast<unsigned char>(aSums[1] / count);
+                out[2] = static_cast<unsigned char>(aSums[2] / count);
+                out[3] = source[(2 * i + 1) * stride + (2 * j + 1) * 4 + 3];
+            }// for
+        }// for
+    });
+}// HalveImage
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Coefficients of the recursive Gaussian: out[n] = B in[n] + b1 out[n-1]
+//  + b2 out[n-2] + b3 out[n-3], with the feedback weights already divided by
+//  b0.  Their sum with B is one, so flat regions stay flat.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct RecursiveCoefficients
+{
+    explicit RecursiveCoefficients(float sigma)
+    {
+        double q = (sigma >= 2.5) ? 0.98711 * sigma - 0.96330
+                                  : 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+        double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+
+        b1 = (float)((2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q) / b0);
+        b2 = (float)(-(1.4281 * q * q + 1.26661 * q * q * q) / b0);
+        b3 = (float)(0.422205 * q * q * q / b0);
+        B = 1.f - (b1 + b2 + b3);
+    }// RecursiveCoefficients
+
+    float   B, b1, b2, b3;
+};// RecursiveCoefficients
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Filter columns [begin, end) of an image of pixels of four floats down
+//  and then up, in place.  Each step works on a whole row of the column range
+//  at once, so with SSE2 every pixel is one register and the rows stream
+//  through memory in order.  The recursion starts from the steady state of
+//  the edge pixel.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void RecursiveColumns(float* aPixels, int width, int height, int begin, int end,
+                             const RecursiveCoefficients& coefficients)
+{
+    size_t  stride = (size_t)width * 4;
+    float   B = coefficients.B, b1 = coefficients.b1, b2 = coefficients.b2, b3 = coefficients.b3;
+
+    std::vector<float> vEdge(stride);
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        // causal pass down the columns, then anti-causal back up, both
+        // starting as if the first row extended forever
+        int     first = pass ? height - 1 : 0;
+        int     step = pass ? -1 : 1;
+        float*  aFirst = &vEdge[0];
+
+        memcpy(aFirst + begin * 4, aPixels + first * stride + begin * 4, (end - begin) * 4 * sizeof(float));
+
+        for (int n = 0; n < height; ++n)
+        {
+            int     y = first + n * step;
+            float*  aRow = aPixels + y * stride;
+            float*  aPrev1 = (n > 0) ? aRow - step * (ptrdiff_t)stride : aFirst;
+            float*  aPrev2 = (n > 1) ? aRow - 2 * step * (ptrdiff_t)stride : aFirst;
+            float*  aPrev3 = (n > 2) ? aRow - 3 * step * (ptrdiff_t)stride : aFirst;
+            int     k = begin * 4;
+
+#ifdef HAVE_SSE2
+            const __m128 vB = _mm_set1_ps(B), v1 = _mm_set1_ps(b1), v2 = _mm_set1_ps(b2), v3 = _mm_set1_ps(b3);
+
+            for (; k < end * 4; k += 4)
+            {
+                __m128 value = _mm_mul_ps(vB, _mm_loadu_ps(aRow + k));
+                value = _mm_add_ps(value, _mm_mul_ps(v1, _mm_loadu_ps(aPrev1 + k)));
+                value = _mm_add_ps(value, _mm_mul_ps(v2, _mm_loadu_ps(aPrev2 + k)));
+                value = _mm_add_ps(value, _mm_mul_ps(v3, _mm_loadu_ps(aPrev3 + k)));
+                _mm_storeu_ps(aRow + k, value);
+            }// for
+#endif
+
+            for (; k < end * 4; ++k)
+                aRow[k] = B * aRow[k] + b1 * aPrev1[k] + b2 * aPrev2[k] + b3 * aPrev3[k];
+        }// for
+    }// for
+}// RecursiveColumns
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Transpose an image of pixels of four floats, in square blocks so both
+//  sides stay in cache.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void TransposePixels(const float* aSource, float* aTarget, int width, int height)
+{
+    ParallelFor(0, (height + c_transposeBlock - 1) / c_transposeBlock, 1, [=](int begin, int end)
+    {
+        for (int block = begin; block < end; ++block)
+            for (int x0 = 0; x0 < width; x0 += c_transposeBlock)
+                for (int y = block * c_transposeBlock; y < Min((block + 1) * c_transposeBlock, height); ++y)
+                    for (int x = x0; x < Min(x0 + c_transposeBlock, width); ++x)
+                        memcpy(aTarget + ((size_t)x * height + y) * 4, aSource + ((size_t)y * width + x) * 4, 4 * sizeof(float));
+    });
+}// TransposePixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Recursive Gaussian.  The vertical pass runs on whole rows; for the
+//  horizontal pass the image is transposed so it can run the same way, and
+//  the result is transposed back before converting to bytes.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RecursiveGaussian(const unsigned char* source, unsigned char* target, int width, int height, float sigma)
+{
+    RecursiveCoefficients   coefficients(sigma);
+    std::vector<float>      vImage((size_t)width * height * 4);
+    std::vector<float>      vTransposed(vImage.size());
+    float*                  aImage = &vImage[0];
+    float*                  aTransposed = &vTransposed[0];
+
+    ParallelFor(0, width * height * 4, 1 << 16, [=](int begin, int end)
+    {
+        for (int k = begin; k < end; ++k)
+            aImage[k] = source[k];
+    });
+
+    ParallelFor(0, width, c_recursiveGrain, [&](int begin, int end)
+    {
+        RecursiveColumns(aImage, width, height, begin, end, coefficients);
+    });
+
+    TransposePixels(aImage, aTransposed, width, height);
+
+    ParallelFor(0, height, c_recursiveGrain, [&](int begin, int end)
+    {
+        RecursiveColumns(aTransposed, height, width, begin, end, coefficients);
+    });
+
+    TransposePixels(aTransposed, aImage, height, width);
+
+    ParallelFor(0, width * height, 1 << 14, [=](int begin, int end)
+    {
+        for (int p = begin; p < end; ++p)
+        {
+            for (int c = 0; c < 3; ++c)
+                target[p * 4 + c] = static_cast<unsigned char>(Min(Max(aImage[p * 4 + c] + 0.5f, 0.f), 255.f));
+            target[p * 4 + 3] = source[p * 4 + 3];
+        }// for
+    });
+}// RecursiveGaussian
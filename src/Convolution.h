@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolution.h
+//
+//      Separable convolution.  A symmetric 2D kernel that is the outer product
+//  of a 1D kernel with itself is applied as a horizontal pass followed by a
+//  vertical pass, costing 2N instead of N * N multiply-adds per channel.
+//  Every filter runs its interior pixels through a loop without bounds
+//  checks and handles the border separately, in a selectable edge mode.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CONVOLUTION_H_
+#define _CONVOLUTION_H_
+
+const int   c_maxBoxRadius  = 2051;         // largest BoxFilter radius, 255 (2 r + 1)^2 within 32 bits
+
+
+enum EEdgeMode                  // treatment of filter taps beyond the border
+{
+    EDGE_RENORMALISE,           // skip them and divide by the weight of the taps used
+    EDGE_CLAMP,                 // repeat the edge pixel
+    EDGE_MIRROR,                // reflect about the edge pixel
+    EDGE_WRAP,                  // tile the image
+    NUM_EDGE_MODES
+};// EEdgeMode
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Edge mode used by the filters from now on, renormalising by default,
+//  and lookup by script name ("renormalise", "clamp", "mirror" or "wrap").
+//  The mode is read once when a filter starts, so it may be changed while
+//  other threads filter.
+//
+///////////////////////////////////////////////////////////////////////////////
+void        SetEdgeMode(EEdgeMode mode);
+EEdgeMode   CurrentEdgeMode();
+bool        FindEdgeMode(const char* sName, EEdgeMode& mode);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convolve the color channels of the RGBA source with the outer product
+//  of the given odd-sized 1D kernel, writing to target, and divide by the
+//  weight of the taps used, truncating, exactly as the direct 2D sum would.
+//  Weights must be below 32768 and keep 255 times the squared weight sum
+//  within 32 bits, which a kernel summing to 4096 does.  Alpha is copied
+//  unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ConvolveSeparable(const unsigned char* source, unsigned char* target, int width, int height,
+                       const int* aWeights, int size, EEdgeMode mode);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      High pass with the same kernel rules as ConvolveSeparable.  Each
+//  color channel of target is the source minus its exact convolution,
+//  truncated and clamped at zero, or with bEnhance the source plus that
+//  signed edge response, 2 source - convolution rounded down, saturating at
+//  0 and 255.  The response is formed
+//  row by row as the convolution produces it, so this costs about the same as
+//  ConvolveSeparable.  Alpha is copied unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void HighPassSeparable(const unsigned char* source, unsigned char* target, int width, int height,
+                       const int* aWeights, int size, EEdgeMode mode, bool bEnhance);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Box filter of the given radius, averaging (2 radius + 1)^2 pixels with
+//  the same border handling and truncation as ConvolveSeparable.  The window
+//  sums slide along rows and columns, so the cost per pixel does not depend
+//  on the radius.  The radius must be at most c_maxBoxRadius, which keeps 255
+//  times the (2 radius + 1)^2 pixel window within 32 bits, the same limit as
+//  the weight sum of ConvolveSeparable.  Alpha is copied unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void BoxFilter(const unsigned char* source, unsigned char* target, int width, int height, int radius,
+               EEdgeMode mode);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Halve the image, each target pixel the 1 2 1 by 1 2 1 weighted average
+//  around source pixel (2i, 2j), truncating.  Target is width / 2 by
+//  height / 2 and takes its alpha from source pixel (2i + 1, 2j + 1).
+//
+///////////////////////////////////////////////////////////////////////////////
+void HalveImage(const unsigned char* source, unsigned char* target, int width, int height, EEdgeMode mode);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gaussian blur of standard deviation sigma, at least 0.5, by the
+//  recursive filter of Young and van Vliet: a causal and an anti-causal third
+//  order pass along each axis, so the cost per pixel does not depend on
+//  sigma.  The recursion starts from the edge pixel, which behaves as
+//  EDGE_CLAMP whatever the edge mode.  Alpha is copied unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RecursiveGaussian(const unsigned char* source, unsigned char* target, int width, int height, float sigma);
+
+#endif // _CONVOLUTION_H_
@@ -0,0 +1,430 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ErrorDiffusion.cpp
+//
+//      Implementation of the error diffusion engine.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "ErrorDiffusion.h"
+#include "PointOps.h"
+#include "Parallel.h"
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#ifdef HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
+// kernel weights by row below the current pixel and horizontal offset, the
+// current pixel in the middle column.  Row 0 only uses the columns right of
+// it, which are mirrored on right to left rows.
+constexpr int   c_aFloydSteinberg[2][3] = { { 0, 0, 7 },
+                                            { 3, 5, 1 } };
+constexpr int   c_aJarvis[3][5]         = { { 0, 0, 0, 7, 5 },
+                                            { 3, 5, 7, 5, 3 },
+                                            { 1, 3, 5, 3, 1 } };
+constexpr int   c_aStucki[3][5]         = { { 0, 0, 0, 8, 4 },
+                                            { 2, 4, 8, 4, 2 },
+                                            { 1, 2, 4, 2, 1 } };
+constexpr int   c_aAtkinson[3][5]       = { { 0, 0, 0, 1, 1 },
+                                            { 0, 1, 1, 1, 0 },
+                                            { 0, 0, 1, 0, 0 } };
+constexpr int   c_aSierra[3][5]         = { { 0, 0, 0, 5, 3 },
+                                            { 2, 4, 5, 4, 2 },
+                                            { 0, 2, 3, 2, 0 } };
+
+const int       c_wavefrontStep         = 32;   // pixels between progress updates of a wavefront row
+
+// script names, in EDiffusionKernel order
+const char      c_asKernelNames[][16]   = { "fs", "jarvis", "stucki", "atkinson", "sierra" };
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernel as compile-time constants.  Error is kept in units of one
+//  Divisor-th, so all arithmetic is exact integer math.  Atkinson's weights
+//  add up to less than the divisor and deliberately lose part of the error.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <int Rows, int Radius, int Divisor, const int (&Weights)[Rows][2 * Radius + 1]>
+struct DiffusionKernel
+{
+    enum
+    {
+        c_rows      = Rows,             // rows reached, including the current one
+        c_radius    = Radius,           // columns reached either side
+        c_divisor   = Divisor
+    };
+
+    static int Weight(int row, int dx)  { return Weights[row][dx + Radius]; }
+
+    // error total in units of 1 / Divisor, rounded to a whole value
+    static int Round(int error)
+    {
+        int shifted = error + Divisor / 2;
+        return (shifted >= 0) ? shifted / Divisor : -((Divisor - 1 - shifted) / Divisor);
+    }// Round
+};// DiffusionKernel
+
+typedef DiffusionKernel<2, 1, 16, c_aFloydSteinberg>    FloydSteinbergKernel;
+typedef DiffusionKernel<3, 2, 48, c_aJarvis>            JarvisKernel;
+typedef DiffusionKernel<3, 2, 42, c_aStucki>            StuckiKernel;
+typedef DiffusionKernel<3, 2, 8, c_aAtkinson>           AtkinsonKernel;
+typedef DiffusionKernel<3, 2, 32, c_aSierra>            SierraKernel;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Ring of error rows: row k of the ring holds the error coming to image
+//  row i + k while row i is dithered, with Radius guard pixels either side so
+//  the kernel never needs bounds checks.  Each pixel has Lanes entries.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Kernel, class T, int Lanes>
+class ErrorRows
+{
+    // methods
+    public:
+        explicit ErrorRows(int width)
+            : m_stride((width + 2 * Kernel::c_radius) * Lanes),
+              m_vErrors((size_t)m_stride * Kernel::c_rows, 0)
+        {
+        }// ErrorRows
+
+        // point the rows at the ring slots of image row i
+        void Start_Row(int i)
+        {
+            for (int k = 0; k < Kernel::c_rows; ++k)
+                aRows[k] = &m_vErrors[(size_t)((i + k) % Kernel::c_rows) * m_stride + Kernel::c_radius * Lanes];
+        }// Start_Row
+
+        // clear the current row, which becomes the last row of the kernel next
+        void Finish_Row()
+        {
+            memset(aRows[0] - Kernel::c_radius * Lanes, 0, m_stride * sizeof(T));
+        }// Finish_Row
+
+    // members
+    public:
+        T*              aRows[Kernel::c_rows];
+
+    private:
+        int             m_stride;
+        std::vector<T>  m_vErrors;
+};// ErrorRows
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set a pixel to black or white by its luminance plus the incoming error
+//  total, and return the error to spread.  The value is not clamped, as in
+//  classic Floyd-Steinberg.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Kernel>
+static inline int DitherGray(unsigned char* pixel, int incoming)
+{
+    int value = Luminance(pixel[0], pixel[1], pixel[2]) + Kernel::Round(incoming);
+    unsigned char out = (value < 128) ? 0 : 255;
+
+    pixel[0] = pixel[1] = pixel[2] = out;
+    return value - out;
+}// DitherGray
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Black and white diffusion of luminance.  The value is not clamped, as
+//  in classic Floyd-Steinberg.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Kernel>
+static void DiffuseGray(unsigned char* rgba, int width, int height)
+{
+    ErrorRows<Kernel, int, 1> errors(width);
+
+    for (int i = 0; i < height; ++i)
+    {
+        // serpentine order: even rows run left to right, odd rows right to left
+        int step = (i % 2 == 0) ? 1 : -1;
+        int j = (step > 0) ? 0 : width - 1;
+
+        errors.Start_Row(i);
+
+        for (int n = 0; n < width; ++n, j += step)
+        {
+            int error = DitherGray<Kernel>(rgba + (((size_t)i * width + j) << 2), errors.aRows[0][j]);
+
+            for (int row = 0; row < Kernel::c_rows; ++row)
+                for (int dx = -Kernel::c_radius; dx <= Kernel::c_radius; ++dx)
+                    if (Kernel::Weight(row, dx))
+                        errors.aRows[row][j + dx * step] += error * Kernel::Weight(row, dx);
+        }// for
+
+        errors.Finish_Row();
+    }// for
+}// DiffuseGray
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Color diffusion onto the 3-3-2 palette, with the conventions of the
+//  reference results.  Channels are floats in [0, 1], serpentine rows start
+//  right to left, and only pixels whose whole kernel lies inside the image
+//  are quantized; border pixels keep the error they collect and are rounded
+//  back to bytes.  A channel value is clamped, truncated to 8 bits and looked
+//  up in a table of the nearest levels.  The rows the kernel reaches hold
+//  values rather than errors, so each pixel adds up its source value and
+//  incoming error in the same order as dithering the whole float image in
+//  place, which keeps the result bit for bit the same.  The three channels
+//  are spread together as lanes of one SSE register.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Kernel>
+static void DiffuseColor(unsigned char* rgba, int width, int height)
+{
+    const int radius = Kernel::c_radius;
+
+    // each truncated channel value maps to the nearest of 8 (red, green) or 4
+    // (blue) evenly spaced levels k 255 / steps, rounded, ties going down
+    unsigned char   aLevels[3][256];
+    float           aLevelValues[3][256];
+    for (int c = 0; c < 3; ++c)
+    {
+        int steps = (c == 2) ? 3 : 7;
+        for (int v = 0, k = 0; v < 256; ++v)
+        {
+            int level = (k * 255 + steps / 2) / steps;
+            int next = ((k + 1) * 255 + steps / 2) / steps;
+            if (k < steps && next - v < v - level)
+                level = next, ++k;
+            aLevels[c][v] = static_cast<unsigned char>(level);
+            aLevelValues[c][v] = (float)level / 255;
+        }// for
+    }// for
+
+    float aWeights[Kernel::c_rows][2 * radius + 1];
+    for (int row = 0; row < Kernel::c_rows; ++row)
+        for (int dx = -radius; dx <= radius; ++dx)
+            aWeights[row][dx + radius] = (float)Kernel::Weight(row, dx) / Kernel::c_divisor;
+
+    // values of the rows the kernel reaches, slot i % rows holding image row
+    // i; processed pixels never spread past the image, so there are no guards
+    size_t              stride = (size_t)width * 4;
+    std::vector<float>  vValues(stride * Kernel::c_rows, 0.f);
+
+    auto Row = [&](int i) { return &vValues[stride * (i % Kernel::c_rows)]; };
+
+    auto Load = [&](int i)
+    {
+        const unsigned char*    pixel = rgba + (size_t)i * width * 4;
+        float*                  aRow = Row(i);
+        for (int j = 0; j < width * 4; ++j)
+            aRow[j] = (float)pixel[j] / 255;
+    };
+
+    auto Store = [&](int i, int begin, int end)
+    {
+        unsigned char*  pixel = rgba + (size_t)i * width * 4;
+        const float*    aRow = Row(i);
+        for (int j = begin; j < end; ++j)
+            for (int c = 0; c < 3; ++c)
+                pixel[j * 4 + c] = static_cast<unsigned char>(Min(Max(floorf(aRow[j * 4 + c] * 255 + 0.5f), 0.f), 255.f));
+    };
+
+    for (int i = 0; i < Kernel::c_rows && i < height; ++i)
+        Load(i);
+
+    for (int i = 0; i < height; ++i)
+    {
+        if (i + Kernel::c_rows <= height && radius < width - radius)
+        {
+            int     step = (i % 2 == 0) ? -1 : 1;
+            int     j = (step > 0) ? radius : width - 1 - radius;
+            float*  aRows[Kernel::c_rows];
+            for (int row = 0; row < Kernel::c_rows; ++row)
+                aRows[row] = Row(i + row);
+
+            for (int n = radius; n < width - radius; ++n, j += step)
+            {
+                unsigned char*  pixel = rgba + (((size_t)i * width + j) << 2);
+                float*          value = aRows[0] + j * 4;
+                float           aError[4] = { 0.f, 0.f, 0.f, 0.f };
+
+                for (int c = 0; c < 3; ++c)
+                {
+                    int level = (int)Min(Max(value[c] * 255, 0.f), 255.f);
+                    pixel[c] = aLevels[c][level];
+                    aError[c] = value[c] - aLevelValues[c][level];
+                }// for
+
+#ifdef HAVE_SSE2
+                __m128 error = _mm_loadu_ps(aError);
+
+                for (int row = 0; row < Kernel::c_rows; ++row)
+                    for (int dx = -radius; dx <= radius; ++dx)
+                        if (Kernel::Weight(row, dx))
+                        {
+                            float* target = aRows[row] + (j + dx * step) * 4;
+                            _mm_storeu_ps(target, _mm_add_ps(_mm_loadu_ps(target),
+                                                             _mm_mul_ps(error, _mm_set1_ps(aWeights[row][dx + radius]))));
+                        }// if
+#else
+                for (int row = 0; row < Kernel::c_rows; ++row)
+                    for (int dx = -radius; dx <= radius; ++dx)
+                        if (Kernel::Weight(row, dx))
+                            for (int c = 0; c < 3; ++c)
+                                aRows[row][(j + dx * step) * 4 + c] += aError[c] * aWeights[row][dx + radius];
+#endif
+            }// for
+
+            Store(i, 0, Min(radius, width));
+            Store(i, Max(width - radius, radius), width);
+        }// if
+        else
+            Store(i, 0, width);
+
+        // the slot of this row is taken by the row the kernel reaches next
+        if (i + Kernel::c_rows < height)
+            Load(i + Kernel::c_rows);
+    }// for
+}// DiffuseColor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Black and white diffusion in raster order, every row running left to
+//  right, for kernels reaching only the next row.  Pixel j of a row takes
+//  error from pixels up to j + Radius of the row above, so rows run
+//  concurrently as a skewed wavefront: each thread owns every n-th row and
+//  waits on the progress counter of the row above.  Error for the rest of
+//  the current row is kept locally, since the row above may still be adding
+//  to the shared error row.  The arithmetic is exact integer math, so the
+//  result is the same for any number of threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Kernel>
+static void DiffuseGrayWavefront(unsigned char* rgba, int width, int height)
+{
+    static_assert(Kernel::c_rows == 2, "the wavefront only follows the row above");
+
+    const int   radius = Kernel::c_radius;
+    int         nThreads = Max(Min(ThreadCount(), height), 1);
+
+    // incoming error of each row, with radius guard entries either side.  At
+    // most nThreads rows are in flight, so nThreads + 1 slots never hand a
+    // slot to a new row while an older one still uses it.
+    int                             nSlots = nThreads + 1;
+    size_t                          stride = (size_t)width + 2 * radius;
+    std::vector<int>                vErrors(stride * nSlots, 0);
+    std::vector<std::atomic<int> >  vProgress(height);
+    for (int i = 0; i < height; ++i)
+        vProgress[i].store(0, std::memory_order_relaxed);
+
+    // threads wait on each other's rows, so they must all run at once
+    ConcurrentChunks(nThreads, [&](int thread)
+    {
+        for (int i = thread; i < height; i += nThreads)
+        {
+            int*    aCurrent = &vErrors[stride * (i % nSlots) + radius];
+            int*    aNext = &vErrors[stride * ((i + 1) % nSlots) + radius];
+            int     aAhead[radius + 1] = {};        // error for pixels j .. j + radius from this row
+            int     ready = i ? 0 : width;
+
+            for (int j = 0; j < width; ++j)
+            {
+                // wait until the row above has finished pixel j + radius
+                while (ready < Min(j + radius + 1, width))
+                {
+                    ready = vProgress[i - 1].load(std::memory_order_acquire);
+                    if (ready < Min(j + radius + 1, width))
+                        std::this_thread::yield();
+                }// while
+
+                int error = DitherGray<Kernel>(rgba + (((size_t)i * width + j) << 2), aCurrent[j] + aAhead[0]);
+
+                for (int dx = 0; dx < radius; ++dx)
+                    aAhead[dx] = aAhead[dx + 1] + error * Kernel::Weight(0, dx + 1);
+                aAhead[radius] = 0;
+
+                for (int dx = -radius; dx <= radius; ++dx)
+                    aNext[j + dx] += error * Kernel::Weight(1, dx);
+
+                if (j % c_wavefrontStep == c_wavefrontStep - 1)
+                    vProgress[i].store(j + 1, std::memory_order_release);
+            }// for
+
+            // this slot is next used by row i + nSlots, which starts after this row is done
+            memset(aCurrent - radius, 0, stride * sizeof(int));
+            vProgress[i].store(width, std::memory_order_release);
+        }// for
+    });
+}// DiffuseGrayWavefront
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither with the given kernel in grayscale or color.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <class Kernel>
+static void Diffuse(unsigned char* rgba, int width, int height, bool bColor)
+{
+    if (bColor)
+        DiffuseColor<Kernel>(rgba, width, height);
+    else
+        DiffuseGray<Kernel>(rgba, width, height);
+}// Diffuse
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look up a kernel by its script name.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FindDiffusionKernel(const char* sName, EDiffusionKernel& kernel)
+{
+    for (int k = 0; k < NUM_DIFFUSION_KERNELS; ++k)
+        if (!strcmp(sName, c_asKernelNames[k]))
+        {
+            kernel = (EDiffusionKernel)k;
+            return true;
+        }// if
+
+    return false;
+}// FindDiffusionKernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dispatch to the loop specialised for the kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ErrorDiffusion(unsigned char* rgba, int width, int height, EDiffusionKernel kernel, bool bColor)
+{
+    switch (kernel)
+    {
+        case DIFFUSE_FLOYD_STEINBERG:   Diffuse<FloydSteinbergKernel>(rgba, width, height, bColor);    break;
+        case DIFFUSE_JARVIS:            Diffuse<JarvisKernel>(rgba, width, height, bColor);            break;
+        case DIFFUSE_STUCKI:            Diffuse<StuckiKernel>(rgba, width, height, bColor);            break;
+        case DIFFUSE_ATKINSON:          Diffuse<AtkinsonKernel>(rgba, width, height, bColor);          break;
+        case DIFFUSE_SIERRA:            Diffuse<SierraKernel>(rgba, width, height, bColor);            break;
+        default:                        break;
+    }// switch
+}// ErrorDiffusion
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Floyd-Steinberg in raster order on the shared kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RasterDiffusion(unsigned char* rgba, int width, int height)
+{
+    DiffuseGrayWavefront<FloydSteinbergKernel>(rgba, width, height);
+}// RasterDiffusion
@@ -0,0 +1,57 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      ErrorDiffusion.h
+//
+//      Error diffusion dithering.  The engine is a template over the kernel,
+//  so each kernel's weights and footprint are compile-time constants and get
+//  their own specialised loop.  Error rows live in a small ring buffer
+//  holding only the rows the kernel reaches.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ERROR_DIFFUSION_H_
+#define _ERROR_DIFFUSION_H_
+
+enum EDiffusionKernel           // available kernels
+{
+    DIFFUSE_FLOYD_STEINBERG,
+    DIFFUSE_JARVIS,
+    DIFFUSE_STUCKI,
+    DIFFUSE_ATKINSON,
+    DIFFUSE_SIERRA,
+    NUM_DIFFUSION_KERNELS
+};// EDiffusionKernel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Kernel with the given script name ("fs", "jarvis", "stucki",
+//  "atkinson" or "sierra").  Returns false for unknown names.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool FindDiffusionKernel(const char* sName, EDiffusionKernel& kernel);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the RGBA image in serpentine order, in place.  In grayscale
+//  every pixel becomes black or white by its luminance.  In color each
+//  channel goes to the nearest of the 3-3-2 palette's evenly spaced levels,
+//  k 255 / steps rounded, following the reference results exactly: the first
+//  row runs right to left, and pixels within the kernel's reach of the left,
+//  right or bottom edge are not quantized but keep the error they receive.
+//  Alpha is left unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ErrorDiffusion(unsigned char* rgba, int width, int height, EDiffusionKernel kernel, bool bColor);
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Black and white Floyd-Steinberg dithering in raster order, every row
+//  left to right, with rows running in parallel as a wavefront.  The result
+//  does not depend on the number of threads.  Alpha is left unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void RasterDiffusion(unsigned char* rgba, int width, int height);
+
+#endif // _ERROR_DIFFUSION_H_
@@ -28,6 +28,12 @@
 #endif
 
 
+// SSE2 is always available on x64 and when gcc or clang target it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define HAVE_SSE2
+#endif
+
+
 // global constants
 const float c_epsilon   = 0.0001f;     // small value used to compare floating point values
 const float c_pi        = 3.14159f;    // the constant pi
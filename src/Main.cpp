@@ -22,6 +22,7 @@
 #include "TargaImage.h"
 #include "ImageWidget.h"
 #include "ScriptHandler.h"
+#include "Parallel.h"
 #include "ProjTest.h"
 
 //#define test
@@ -31,6 +32,8 @@ using namespace std;
 // constants
 const char      c_sNames[]          = "-names";             // display student names command line switch
 const char      c_sHeadless[]       = "-headless";          // headless command line switch
+const char      c_sThreads[]        = "-threads";           // worker thread count command line switch
+const char      c_sGrain[]          = "-grain";             // rows per parallel band command line switch
 
 // globals
 std::vector<char*>  vsStudentNames;
@@ -111,12 +114,16 @@ int main(int argc, char *argv[])
         //load D:\Team\NTUST\graphic\ImageEditing\Images\wiz.tga
         if (!strcmp(argv[i], c_sNames))                                 // display names
             DisplayNames();
+        else if (!strcmp(argv[i], c_sThreads) && i + 1 < argc)          // thread count
+            SetThreadCount(atoi(argv[++i]));
+        else if (!strcmp(argv[i], c_sGrain) && i + 1 < argc)            // rows per band
+            SetRowGrain(atoi(argv[++i]));
         else if (!bHeadless && !strcmp(argv[i], c_sHeadless))           // go headless
             bHeadless = true;
         else if (bHeadless && strcmp(argv[i], c_sHeadless))             // run script file
             CScriptHandler::HandleScriptFile(argv[i], pImage);
         else {
-            cerr << "Usage:" << endl << "Project1 [-names] [-headless scriptFilenames . . .]" << endl;
+            cerr << "Usage:" << endl << "Project1 [-names] [-threads n] [-grain rows] [-headless scriptFilenames . . .]" << endl;
             return 0;
         }// else
     }// for
@@ -0,0 +1,289 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      OrderedDither.cpp
+//
+//      Implementation of the ordered dithering engine.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "OrderedDither.h"
+#include "PointOps.h"
+#include "Parallel.h"
+#include "Random.h"
+#include <math.h>
+#include <mutex>
+#include <vector>
+
+#ifdef HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
+// constants
+const int   c_ditherGrain   = 16;               // minimum rows per dithering thread
+const float c_blueNoiseSigma    = 1.5f;         // spread of the void-and-cluster energy filter
+const int   c_blueNoiseSeed     = 1;            // fixed, so the mask is the same on every run
+
+// matrices, evaluated by the compiler
+constexpr DitherMatrix<2>   c_bayer2        = BayerMatrix<2>();
+constexpr DitherMatrix<4>   c_bayer4        = BayerMatrix<4>();
+constexpr DitherMatrix<8>   c_bayer8        = BayerMatrix<8>();
+constexpr DitherMatrix<16>  c_bayer16       = BayerMatrix<16>();
+constexpr DitherMatrix<2>   c_cluster2      = ClusterMatrix<2>();
+constexpr DitherMatrix<4>   c_cluster4      = ClusterMatrix<4>();
+constexpr DitherMatrix<8>   c_cluster8      = ClusterMatrix<8>();
+constexpr DitherMatrix<16>  c_cluster16     = ClusterMatrix<16>();
+
+static_assert(KeepsBlackAndWhite(c_bayer2) && KeepsBlackAndWhite(c_bayer4) &&
+              KeepsBlackAndWhite(c_bayer8) && KeepsBlackAndWhite(c_bayer16), "Bayer matrix turns black white");
+static_assert(KeepsBlackAndWhite(c_cluster2) && KeepsBlackAndWhite(c_cluster4) &&
+              KeepsBlackAndWhite(c_cluster8) && KeepsBlackAndWhite(c_cluster16), "cluster matrix turns black white");
+static_assert(RankThreshold(0, c_blueNoiseSize * c_blueNoiseSize) > 0, "blue noise mask turns black white");
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bayer thresholds of the given size, or NULL.
+//
+///////////////////////////////////////////////////////////////////////////////
+const unsigned char* BayerThresholds(int size)
+{
+    switch (size)
+    {
+        case 2:     return c_bayer2.thresholds[0];
+        case 4:     return c_bayer4.thresholds[0];
+        case 8:     return c_bayer8.thresholds[0];
+        case 16:    return c_bayer16.thresholds[0];
+        default:    return NULL;
+    }// switch
+}// BayerThresholds
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Cluster thresholds of the given size, or NULL.
+//
+///////////////////////////////////////////////////////////////////////////////
+const unsigned char* ClusterThresholds(int size)
+{
+    switch (size)
+    {
+        case 2:     return c_cluster2.thresholds[0];
+        case 4:     return c_cluster4.thresholds[0];
+        case 8:     return c_cluster8.thresholds[0];
+        case 16:    return c_cluster16.thresholds[0];
+        default:    return NULL;
+    }// switch
+}// ClusterThresholds
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Energy of the pixels of a binary pattern on the torus: the sum over all
+//  set pixels of a Gaussian of the distance.  Clusters have high energy and
+//  voids low energy, and toggling a pixel only adds or removes its kernel.
+//
+///////////////////////////////////////////////////////////////////////////////
+class VoidClusterEnergy
+{
+    // methods
+    public:
+        VoidClusterEnergy(int size, float sigma)
+            : m_size(size), m_vKernel(size * size), m_vEnergy(size * size, 0.f)
+        {
+            for (int y = 0; y < size; ++y)
+                for (int x = 0; x < size; ++x)
+                {
+                    int dx = Min(x, size - x);
+                    int dy = Min(y, size - y);
+                    m_vKernel[y * size + x] = expf(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+                }// for
+        }// VoidClusterEnergy
+
+        // add (sign 1) or remove (sign -1) the kernel of a set pixel
+        void Toggle(int pixel, float sign)
+        {
+            int mask = m_size - 1;
+            int px = pixel & mask;
+            int py = pixel / m_size;
+
+            for (int y = 0; y < m_size; ++y)
+            {
+                const float*    aKernel = &m_vKernel[((y - py) & mask) * m_size];
+                float*          aEnergy = &m_vEnergy[y * m_size];
+                for (int x = 0; x < m_size; ++x)
+                    aEnergy[x] += sign * aKernel[(x - px) & mask];
+            }// for
+        }// Toggle
+
+        // highest energy set pixel, or lowest energy clear pixel
+        int Tightest_Cluster(const std::vector<bool>& vPattern) const   { return Extreme(vPattern, true); }
+        int Largest_Void(const std::vector<bool>& vPattern) const       { return Extreme(vPattern, false); }
+
+    private:
+        int Extreme(const std::vector<bool>& vPattern, bool bSet) const
+        {
+            int best = -1;
+            for (int p = 0; p < (int)m_vEnergy.size(); ++p)
+                if (vPattern[p] == bSet && (best < 0 || (bSet ? m_vEnergy[p] > m_vEnergy[best]
+                                                              : m_vEnergy[p] < m_vEnergy[best])))
+                    best = p;
+            return best;
+        }// Extreme
+
+    // members
+    private:
+        int                 m_size;             // power of two
+        std::vector<float>  m_vKernel;          // Gaussian by wrapped offset
+        std::vector<float>  m_vEnergy;
+};// VoidClusterEnergy
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Rank every pixel of a size x size tile by the void-and-cluster method:
+//  a random sparse pattern is relaxed by moving its tightest cluster into its
+//  largest void until that changes nothing; then its pixels are ranked by
+//  repeatedly removing the tightest cluster, and the remaining pixels by
+//  repeatedly filling the largest void.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void VoidAndCluster(int size, std::vector<int>& vRanks)
+{
+    int                 nPixels = size * size;
+    int                 nInitial = nPixels / 10;
+    std::vector<bool>   vPattern(nPixels, false);
+    VoidClusterEnergy   energy(size, c_blueNoiseSigma);
+    Random              random(c_blueNoiseSeed, 0);
+
+    for (int placed = 0; placed < nInitial; )
+    {
+        int p = (int)random.Range(nPixels);
+        if (!vPattern[p])
+        {
+            vPattern[p] = true;
+            energy.Toggle(p, 1.f);
+            ++placed;
+        }// if
+    }// for
+
+    // relax the initial pattern; every move lowers the total energy
+    for (int move = 0; move < nPixels; ++move)
+    {
+        int cluster = energy.Tightest_Cluster(vPattern);
+        vPattern[cluster] = false;
+        energy.Toggle(cluster, -1.f);
+
+        int hole = energy.Largest_Void(vPattern);
+        vPattern[hole] = true;
+        energy.Toggle(hole, 1.f);
+
+        if (hole == cluster)
+            break;
+    }// for
+
+    vRanks.assign(nPixels, 0);
+
+    // rank the initial pixels, last removed first
+    std::vector<bool>   vRemaining(vPattern);
+    VoidClusterEnergy   removal(energy);
+    for (int rank = nInitial - 1; rank >= 0; --rank)
+    {
+        int cluster = removal.Tightest_Cluster(vRemaining);
+        vRemaining[cluster] = false;
+        removal.Toggle(cluster, -1.f);
+        vRanks[cluster] = rank;
+    }// for
+
+    // then fill the voids
+    for (int rank = nInitial; rank < nPixels; ++rank)
+    {
+        int hole = energy.Largest_Void(vPattern);
+        vPattern[hole] = true;
+        energy.Toggle(hole, 1.f);
+        vRanks[hole] = rank;
+    }// for
+}// VoidAndCluster
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Blue noise thresholds, generated once.  The 4096 ranks share the 255
+//  thresholds from 1 up, 16 to a level, so none is 0.
+//
+///////////////////////////////////////////////////////////////////////////////
+const unsigned char* BlueNoiseThresholds()
+{
+    static std::once_flag               s_once;
+    static std::vector<unsigned char>   s_vThresholds;
+
+    std::call_once(s_once, []()
+    {
+        std::vector<int> vRanks;
+        VoidAndCluster(c_blueNoiseSize, vRanks);
+
+        s_vThresholds.resize(vRanks.size());
+        for (size_t p = 0; p < vRanks.size(); ++p)
+            s_vThresholds[p] = RankThreshold(vRanks[p], (int)vRanks.size());
+    });
+
+    return &s_vThresholds[0];
+}// BlueNoiseThresholds
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image against the tiled matrix.  Each row is converted to
+//  gray in a row buffer, then thresholded 16 pixels at a time: the matrix row
+//  is repeated to at least 16 entries, so as both are powers of two every
+//  group of 16 pixels lines up with one 16 byte slice of it.  The 0 or 255
+//  results are spread over the color bytes of each pixel, keeping alpha.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OrderedDither(unsigned char* rgba, int width, int height, const unsigned char* aThresholds, int size)
+{
+    ParallelFor(0, height, c_ditherGrain, [=](int begin, int end)
+    {
+        std::vector<unsigned char> vGray(width);
+        int repeat = Max(size, 16);
+        std::vector<unsigned char> vRepeated(repeat);
+
+        for (int i = begin; i < end; ++i)
+        {
+            const unsigned char*    aRow = aThresholds + (i & (size - 1)) * size;
+            unsigned char*          pixel = rgba + (size_t)i * width * 4;
+
+            for (int j = 0; j < width; ++j)
+                vGray[j] = Luminance(pixel[j * 4], pixel[j * 4 + 1], pixel[j * 4 + 2]);
+
+            int j = 0;
+
+#ifdef HAVE_SSE2
+            for (int k = 0; k < repeat; ++k)
+                vRepeated[k] = aRow[k & (size - 1)];
+
+            const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+            for (; j + 16 <= width; j += 16, pixel += 64)
+            {
+                __m128i limit = _mm_loadu_si128((const __m128i*)&vRepeated[j & (repeat - 1)]);
+                __m128i gray = _mm_loadu_si128((const __m128i*)&vGray[j]);
+                __m128i white = _mm_cmpeq_epi8(_mm_max_epu8(gray, limit), gray);
+                __m128i pairs[2] = { _mm_unpacklo_epi8(white, white), _mm_unpackhi_epi8(white, white) };
+
+                for (int k = 0; k < 4; ++k)
+                {
+                    __m128i spread = (k & 1) ? _mm_unpackhi_epi16(pairs[k >> 1], pairs[k >> 1])
+                                             : _mm_unpacklo_epi16(pairs[k >> 1], pairs[k >> 1]);
+                    __m128i* target = (__m128i*)(pixel + k * 16);
+                    __m128i value = _mm_loadu_si128(target);
+                    _mm_storeu_si128(target, _mm_or_si128(_mm_andnot_si128(alpha, spread), _mm_and_si128(alpha, value)));
+                }// for
+            }// for
+#endif
+
+            for (; j < width; ++j, pixel += 4)
+                pixel[0] = pixel[1] = pixel[2] = (vGray[j] >= aRow[j & (size - 1)]) ? 255 : 0;
+        }// for
+    });
+}// OrderedDither
@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      OrderedDither.h
+//
+//      Ordered dithering against a tiled threshold matrix.  Bayer and cluster
+//  matrices of power of two sizes up to 16 are built at compile time, and a
+//  blue noise mask is generated on first use; the engine thresholds whole rows at
+//  once and runs rows in parallel.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _ORDERED_DITHER_H_
+#define _ORDERED_DITHER_H_
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Size x Size matrix of thresholds.  A pixel goes white when its gray
+//  level is at least the threshold of its position.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <int Size>
+struct DitherMatrix
+{
+    unsigned char   thresholds[Size][Size];
+};// DitherMatrix
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Threshold of the cell with the given rank out of nCells, spread evenly
+//  over [1, 255] so a flat gray g turns about g / 255 of them white, black
+//  stays black and white stays white.  Past 256 cells thresholds repeat.
+//
+///////////////////////////////////////////////////////////////////////////////
+constexpr unsigned char RankThreshold(int rank, int nCells)
+{
+    return static_cast<unsigned char>(rank * 255 / nCells + 1);
+}// RankThreshold
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Whether black and white pixels dither to themselves: white always
+//  reaches a byte threshold, and black does only at a zero threshold.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <int Size>
+constexpr bool KeepsBlackAndWhite(const DitherMatrix<Size>& matrix)
+{
+    for (int y = 0; y < Size; ++y)
+        for (int x = 0; x < Size; ++x)
+            if (matrix.thresholds[y][x] == 0)
+                return false;
+    return true;
+}// KeepsBlackAndWhite
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Bayer matrix, built by the usual recursion
+//      M(2n) = [ 4 M(n) + 0, 4 M(n) + 2 ; 4 M(n) + 3, 4 M(n) + 1 ]
+//  unrolled over the bits of the coordinates.  Size must be a power of two
+//  no larger than 16, so each of the Size^2 ranks gets its own threshold.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <int Size>
+constexpr DitherMatrix<Size> BayerMatrix()
+{
+    static_assert(Size >= 2 && Size <= 16 && (Size & (Size - 1)) == 0, "size must be a power of two up to 16");
+
+    DitherMatrix<Size> matrix = {};
+    for (int y = 0; y < Size; ++y)
+        for (int x = 0; x < Size; ++x)
+        {
+            // the lowest bits pick the 2x2 entry with the largest weight
+            int rank = 0;
+            for (int bit = 1, weight = Size * Size / 4; bit < Size; bit <<= 1, weight >>= 2)
+            {
+                int xBit = (x & bit) ? 1 : 0;
+                int yBit = (y & bit) ? 1 : 0;
+                rank += (2 * (xBit ^ yBit) + yBit) * weight;
+            }// for
+            matrix.thresholds[y][x] = RankThreshold(rank, Size * Size);
+        }// for
+
+    return matrix;
+}// BayerMatrix
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Clustered dot matrix: cells are ranked by distance from the centre of
+//  the tile, so a dot grows outwards as the gray level rises.  Equal
+//  distances are ranked in raster order.  Ranks come from a counting sort on
+//  the squared distance, which keeps large sizes cheap to evaluate.  Size
+//  must be a power of two no larger than 16, as for BayerMatrix.
+//
+///////////////////////////////////////////////////////////////////////////////
+template <int Size>
+constexpr DitherMatrix<Size> ClusterMatrix()
+{
+    static_assert(Size >= 2 && Size <= 16 && (Size & (Size - 1)) == 0, "size must be a power of two up to 16");
+
+    // squared distance, in half cells, from the centre of the tile
+    const int maxDistance = 2 * (Size - 1) * (Size - 1);
+    int aFirst[maxDistance + 2] = {};
+
+    for (int y = 0; y < Size; ++y)
+        for (int x = 0; x < Size; ++x)
+            ++aFirst[((2 * x + 1 - Size) * (2 * x + 1 - Size) + (2 * y + 1 - Size) * (2 * y + 1 - Size)) / 2 + 1];
+    for (int d = 1; d <= maxDistance + 1; ++d)
+        aFirst[d] += aFirst[d - 1];
+
+    DitherMatrix<Size> matrix = {};
+    for (int y = 0; y < Size; ++y)
+        for (int x = 0; x < Size; ++x)
+        {
+            int rank = aFirst[((2 * x + 1 - Size) * (2 * x + 1 - Size) + (2 * y + 1 - Size) * (2 * y + 1 - Size)) / 2]++;
+            matrix.thresholds[y][x] = RankThreshold(rank, Size * Size);
+        }// for
+
+    return matrix;
+}// ClusterMatrix
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Thresholds of the Bayer or cluster matrix of the given size, stored row
+//  by row.  Sizes 2, 4, 8 and 16 are available; others return NULL.
+//
+///////////////////////////////////////////////////////////////////////////////
+const unsigned char* BayerThresholds(int size);
+const unsigned char* ClusterThresholds(int size);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Thresholds of the c_blueNoiseSize x c_blueNoiseSize blue noise mask.
+//  The mask is generated by the void-and-cluster method the first time it is
+//  asked for, which takes a few tens of milliseconds, and kept for the rest
+//  of the run.  Safe to call from several threads.
+//
+///////////////////////////////////////////////////////////////////////////////
+const int c_blueNoiseSize = 64;
+
+const unsigned char* BlueNoiseThresholds();
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the RGBA image to gray and threshold every pixel against the
+//  size x size matrix tiled over the image.  Size must be a power of two.
+//  Alpha is left unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void OrderedDither(unsigned char* rgba, int width, int height, const unsigned char* aThresholds, int size);
+
+#endif // _ORDERED_DITHER_H_
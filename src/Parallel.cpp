@@ -0,0 +1,433 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parallel.cpp
+//
+//      Implementation of the thread pool and the parallel loop helpers.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "Parallel.h"
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// constants
+const char  c_sThreadsVariable[]    = "IMAGE_THREADS";  // environment variable with the thread count
+const char  c_sGrainVariable[]      = "IMAGE_GRAIN";    // environment variable with the row grain
+const int   c_defaultRowGrain       = 16;               // rows per band unless configured
+const int   c_rangesPerThread       = 4;                // ranges ParallelFor makes per thread, so there is work to steal
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Pool of worker threads, each with its own queue of loop chunks.  A
+//  thread takes the newest chunk of its own queue and, when that is empty,
+//  steals the oldest chunk of another queue.  A thread starting a loop runs
+//  chunks too until its loop is done, so loops may nest inside chunks.
+//
+///////////////////////////////////////////////////////////////////////////////
+class ThreadPool
+{
+    // methods
+    public:
+        explicit ThreadPool(int nWorkers);
+        ~ThreadPool();
+
+        int  Workers() const    { return (int)m_vThreads.size(); }
+        void Run(int begin, int end, int nChunks, const std::function<void(int, int, int)>& body);
+
+    // types
+    private:
+        struct Loop
+        {
+            const std::function<void(int, int, int)>*   pBody;
+            int                                         begin;
+            int                                         nItems;
+            int                                         nChunks;
+            std::atomic<int>                            nRemaining;     // queued chunks not yet done
+        };// Loop
+
+        struct Task
+        {
+            Loop*   pLoop;
+            int     chunk;
+        };// Task
+
+        struct Queue
+        {
+            std::mutex          mutex;
+            std::deque<Task>    tasks;
+        };// Queue
+
+    private:
+        bool Run_Task(int home);                            // run one queued chunk, if there is any
+        void Run_Chunk(Loop& loop, int chunk);
+        void Worker(int index);
+
+    // members
+    private:
+        std::vector<std::unique_ptr<Queue> >    m_vQueues;      // one per worker
+        std::vector<std::thread>                m_vThreads;
+        std::mutex                              m_mutex;        // guards sleeping and waking
+        std::condition_variable                 m_wake;         // chunks queued, loop done or stopping
+        std::atomic<int>                        m_nQueued;      // chunks in all queues
+        std::atomic<unsigned int>               m_nextQueue;    // queue for the next chunk from outside the pool
+        bool                                    m_bStop;
+};// ThreadPool
+
+
+// the pool a worker thread belongs to, and its queue
+static thread_local ThreadPool*     s_pWorkerPool = NULL;
+static thread_local int             s_workerIndex = -1;
+
+// process-wide pool and settings; zero means not configured
+static std::mutex                   s_poolMutex;
+static std::shared_ptr<ThreadPool>  s_pPool;
+static std::atomic<int>             s_threadCount(0);
+static std::atomic<int>             s_rowGrain(0);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Start the workers.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(int nWorkers) : m_nQueued(0), m_nextQueue(0), m_bStop(false)
+{
+    for (int i = 0; i < Max(nWorkers, 1); ++i)
+        m_vQueues.push_back(std::unique_ptr<Queue>(new Queue));
+
+    for (int i = 0; i < nWorkers; ++i)
+        m_vThreads.push_back(std::thread(&ThreadPool::Worker, this, i));
+}// ThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Destructor.  Stop and join the workers.  No loop may be running.
+//
+///////////////////////////////////////////////////////////////////////////////
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_vThreads.size(); ++i)
+        m_vThreads[i].join();
+}// ~ThreadPool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split [begin, end) into nChunks ranges and run the body for each.  The
+//  calling thread queues all chunks but the first, runs the first, and then
+//  helps with queued chunks until every chunk of its loop is done.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Run(int begin, int end, int nChunks, const std::function<void(int, int, int)>& body)
+{
+    Loop loop;
+    loop.pBody = &body;
+    loop.begin = begin;
+    loop.nItems = Max(end - begin, 0);
+    loop.nChunks = nChunks;
+    loop.nRemaining.store(nChunks - 1);
+
+    // a worker queues its chunks for others to steal; other threads spread them
+    int home = (s_pWorkerPool == this) ? s_workerIndex : -1;
+
+    for (int chunk = 1; chunk < nChunks; ++chunk)
+    {
+        int     index = (home >= 0) ? home : (int)(m_nextQueue++ % m_vQueues.size());
+        Queue&  queue = *m_vQueues[index];
+        Task    task = { &loop, chunk };
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }// for
+
+    m_nQueued += nChunks - 1;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_wake.notify_all();
+
+    Run_Chunk(loop, 0);
+
+    while (loop.nRemaining.load() > 0)
+    {
+        if (Run_Task(home))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [&] { return loop.nRemaining.load() == 0 || m_nQueued.load() > 0; });
+    }// while
+}// Run
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Take a chunk from the home queue, newest first, or else steal the
+//  oldest chunk of another queue, and run it.  Threads outside the pool have
+//  no home queue.  Return whether a chunk was run.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::Run_Task(int home)
+{
+    Task task;
+    bool bFound = false;
+
+    if (home >= 0)
+    {
+        Queue& queue = *m_vQueues[home];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            bFound = true;
+        }// if
+    }// if
+
+    for (size_t k = 0; !bFound && k < m_vQueues.size(); ++k)
+    {
+        Queue& queue = *m_vQueues[(home + 1 + k) % m_vQueues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty())
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            bFound = true;
+        }// if
+    }// for
+
+    if (!bFound)
+        return false;
+
+    --m_nQueued;
+    Run_Chunk(*task.pLoop, task.chunk);
+
+    // the loop's owner may return as soon as the count reaches zero
+    if (task.pLoop->nRemaining.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wake.notify_all();
+    }// if
+
+    return true;
+}// Run_Task
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the body on one chunk of a loop.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Run_Chunk(Loop& loop, int chunk)
+{
+    int chunkBegin = loop.begin + (int)((long long)loop.nItems * chunk / loop.nChunks);
+    int chunkEnd = loop.begin + (int)((long long)loop.nItems * (chunk + 1) / loop.nChunks);
+
+    (*loop.pBody)(chunk, chunkBegin, chunkEnd);
+}// Run_Chunk
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Body of a worker thread.  Run chunks while there are any, and sleep
+//  until more are queued.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ThreadPool::Worker(int index)
+{
+    s_pWorkerPool = this;
+    s_workerIndex = index;
+
+    for (;;)
+    {
+        if (Run_Task(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this] { return m_bStop || m_nQueued.load() > 0; });
+        if (m_bStop)
+            return;
+    }// for
+}// Worker
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Positive integer held by an environment variable, or zero.
+//
+///////////////////////////////////////////////////////////////////////////////
+static int EnvironmentCount(const char* sName)
+{
+    const char* sValue = getenv(sName);
+    return sValue ? Max(atoi(sValue), 0) : 0;
+}// EnvironmentCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      The pool sized for the current thread count, replacing the previous
+//  one if the count has changed.
+//
+///////////////////////////////////////////////////////////////////////////////
+static std::shared_ptr<ThreadPool> Pool()
+{
+    std::lock_guard<std::mutex> lock(s_poolMutex);
+
+    int nWorkers = ThreadCount() - 1;
+    if (!s_pPool || s_pPool->Workers() != nWorkers)
+    {
+        s_pPool.reset();
+        s_pPool = std::make_shared<ThreadPool>(nWorkers);
+    }// if
+
+    return s_pPool;
+}// Pool
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of threads parallel loops are spread over.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ThreadCount()
+{
+    static const int nEnvironment = EnvironmentCount(c_sThreadsVariable);
+    static const int nDefault = nEnvironment ? nEnvironment : Max((int)std::thread::hardware_concurrency(), 1);
+
+    int nThreads = s_threadCount.load();
+    return (nThreads > 0) ? nThreads : nDefault;
+}// ThreadCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the number of threads parallel loops are spread over.  The pool is
+//  resized by the next loop.
+//
+///////////////////////////////////////////////////////////////////////////////
+void SetThreadCount(int nThreads)
+{
+    s_threadCount.store(Max(nThreads, 0));
+}// SetThreadCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fewest image rows in one band of ParallelRows.
+//
+///////////////////////////////////////////////////////////////////////////////
+int RowGrain()
+{
+    static const int nEnvironment = EnvironmentCount(c_sGrainVariable);
+    static const int nDefault = nEnvironment ? nEnvironment : c_defaultRowGrain;
+
+    int rows = s_rowGrain.load();
+    return (rows > 0) ? rows : nDefault;
+}// RowGrain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the fewest image rows in one band of ParallelRows.
+//
+///////////////////////////////////////////////////////////////////////////////
+void SetRowGrain(int rows)
+{
+    s_rowGrain.store(Max(rows, 0));
+}// SetRowGrain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of chunks ParallelChunks splits [begin, end) into when every
+//  chunk should hold at least grain items.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ChunkCount(int begin, int end, int grain)
+{
+    int nItems = end - begin;
+    if (nItems <= 0)
+        return 1;
+
+    return Max(Min(ThreadCount(), nItems / Max(grain, 1)), 1);
+}// ChunkCount
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split [begin, end) into nChunks contiguous ranges and run the body for
+//  each of them on the pool.  A single chunk runs directly on the calling
+//  thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ParallelChunks(int begin, int end, int nChunks, const std::function<void(int, int, int)>& body)
+{
+    if (nChunks <= 1)
+    {
+        body(0, begin, Max(end, begin));
+        return;
+    }// if
+
+    Pool()->Run(begin, end, nChunks, body);
+}// ParallelChunks
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the body for every chunk on a thread of its own.  The calling
+//  thread runs the first chunk.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ConcurrentChunks(int nChunks, const std::function<void(int)>& body)
+{
+    std::vector<std::thread> vThreads;
+    for (int chunk = 1; chunk < nChunks; ++chunk)
+        vThreads.push_back(std::thread(std::cref(body), chunk));
+
+    body(0);
+
+    for (size_t i = 0; i < vThreads.size(); ++i)
+        vThreads[i].join();
+}// ConcurrentChunks
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the body over [begin, end) split into ranges of at least grain
+//  items, a few per thread.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body)
+{
+    int nThreads = ThreadCount();
+    int nRanges = (nThreads > 1) ? Min((end - begin) / Max(grain, 1), nThreads * c_rangesPerThread) : 1;
+
+    ParallelChunks(begin, end, Max(nRanges, 1),
+                   [&body](int, int rangeBegin, int rangeEnd) { body(rangeBegin, rangeEnd); });
+}// ParallelFor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the body over the rows [begin, end) in bands of at least
+//  RowGrain() rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ParallelRows(int begin, int end, const std::function<void(int, int)>& body)
+{
+    ParallelFor(begin, end, RowGrain(), body);
+}// ParallelRows
@@ -0,0 +1,105 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Parallel.h
+//
+//      Helpers to split loops over pixels or rows across hardware threads.
+//  Loops run on one process-wide work-stealing thread pool, which the calling
+//  thread joins until its loop is done.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <functional>
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of threads parallel loops are spread over, counting the calling
+//  thread.  Defaults to the IMAGE_THREADS environment variable, or to the
+//  number of hardware threads when that is not set.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ThreadCount();
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the number of threads parallel loops are spread over.  Zero or less
+//  restores the default.  Must not be called while a parallel loop runs.
+//
+///////////////////////////////////////////////////////////////////////////////
+void SetThreadCount(int nThreads);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fewest image rows in one band of ParallelRows.  Defaults to the
+//  IMAGE_GRAIN environment variable, or to 16.
+//
+///////////////////////////////////////////////////////////////////////////////
+int RowGrain();
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the fewest image rows in one band of ParallelRows.  Zero or less
+//  restores the default.
+//
+///////////////////////////////////////////////////////////////////////////////
+void SetRowGrain(int rows);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Number of chunks ParallelChunks splits [begin, end) into when every
+//  chunk should hold at least grain items.  Always at least one.
+//
+///////////////////////////////////////////////////////////////////////////////
+int ChunkCount(int begin, int end, int grain);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Split [begin, end) into nChunks contiguous ranges and run body(chunk,
+//  chunkBegin, chunkEnd) for each of them on the pool.  Returns once all
+//  chunks are done.  Chunk indices let the body keep per-chunk private state,
+//  such as partial histograms, which the caller merges afterwards.  Chunks
+//  are not guaranteed to run at the same time, so they must not wait on each
+//  other.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ParallelChunks(int begin, int end, int nChunks, const std::function<void(int, int, int)>& body);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(chunk) for every chunk in [0, nChunks) on threads of its own,
+//  all at the same time, so chunks may wait on each other's progress.  Only
+//  for algorithms that need it, such as wavefronts; everything else should
+//  use the pool.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ConcurrentChunks(int nChunks, const std::function<void(int)>& body);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(rangeBegin, rangeEnd) over [begin, end) split into ranges of
+//  at least grain items.  There are a few ranges per thread, so threads that
+//  finish early steal the ranges of slower ones.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run body(rowBegin, rowEnd) over the rows [begin, end) of an image in
+//  bands of at least RowGrain() rows.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ParallelRows(int begin, int end, const std::function<void(int, int)>& body);
+
+#endif // _PARALLEL_H_
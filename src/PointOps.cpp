@@ -0,0 +1,391 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PointOps.cpp
+//
+//      Implementation of ChannelLut and PointChain methods.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Globals.h"
+#include "PointOps.h"
+#include "Parallel.h"
+#include <string.h>
+#include <math.h>
+
+#ifdef HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
+// constants
+const int   c_pointGrain        = 1 << 16;      // minimum pixels per point operation range
+const int   c_histogramGrain    = 1 << 16;      // minimum pixels per histogram thread
+const int   c_thresholdGrain    = 1 << 16;      // minimum pixels per threshold thread
+
+
+// Round and clamp a floating point channel value to 8 bits
+static inline unsigned char ClampByte(float value)
+{
+    return static_cast<unsigned char>(Min(Max(value + 0.5f, 0.f), 255.f));
+}// ClampByte
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Constructor.  Build the identity table.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut::ChannelLut()
+{
+    for (int i = 0; i < 256; ++i)
+        table[0][i] = table[1][i] = table[2][i] = static_cast<unsigned char>(i);
+}// ChannelLut
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Keep only the given number of high bits of each channel, as uniform
+//  quantization does.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut ChannelLut::Quantize(int bitsR, int bitsG, int bitsB)
+{
+    const int   aShift[3] = { 8 - bitsR, 8 - bitsG, 8 - bitsB };
+    ChannelLut  lut;
+
+    for (int c = 0; c < 3; ++c)
+        for (int i = 0; i < 256; ++i)
+            lut.table[c][i] = static_cast<unsigned char>(i >> aShift[c] << aShift[c]);
+
+    return lut;
+}// Quantize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Values below the threshold go to black, the rest to white.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut ChannelLut::Threshold(int threshold)
+{
+    ChannelLut lut;
+
+    for (int i = 0; i < 256; ++i)
+        lut.table[0][i] = lut.table[1][i] = lut.table[2][i] = (i < threshold) ? 0 : 255;
+
+    return lut;
+}// Threshold
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Linearly stretch the range [black, white] to the full range, clamping
+//  values outside of it.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut ChannelLut::Levels(int black, int white)
+{
+    ChannelLut  lut;
+    float       scale = 255.f / Max(white - black, 1);
+
+    for (int i = 0; i < 256; ++i)
+        lut.table[0][i] = lut.table[1][i] = lut.table[2][i] = ClampByte((i - black) * scale);
+
+    return lut;
+}// Levels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Gamma correction.  Gammas above one brighten the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut ChannelLut::Gamma(float gamma)
+{
+    ChannelLut  lut;
+    float       exponent = 1.f / gamma;
+
+    for (int i = 0; i < 256; ++i)
+        lut.table[0][i] = lut.table[1][i] = lut.table[2][i] = ClampByte(255.f * powf(i / 255.f, exponent));
+
+    return lut;
+}// Gamma
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Snap each channel to the nearest of the given number of evenly spaced
+//  levels, which must be at least two.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut ChannelLut::Posterize(int levels)
+{
+    ChannelLut  lut;
+    float       step = 255.f / (levels - 1);
+
+    for (int i = 0; i < 256; ++i)
+        lut.table[0][i] = lut.table[1][i] = lut.table[2][i] = ClampByte(floorf(i / step + 0.5f) * step);
+
+    return lut;
+}// Posterize
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Invert each channel.
+//
+///////////////////////////////////////////////////////////////////////////////
+ChannelLut ChannelLut::Invert()
+{
+    ChannelLut lut;
+
+    for (int i = 0; i < 256; ++i)
+        lut.table[0][i] = lut.table[1][i] = lut.table[2][i] = static_cast<unsigned char>(255 - i);
+
+    return lut;
+}// Invert
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Compose the given table onto this one, so a single lookup does the work
+//  of this table followed by next.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ChannelLut::Then(const ChannelLut& next)
+{
+    for (int c = 0; c < 3; ++c)
+        for (int i = 0; i < 256; ++i)
+            table[c][i] = next.table[c][table[c][i]];
+}// Then
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look up the red, green and blue channels of the given RGBA pixels in
+//  place.  Alpha is left unchanged.  The three tables take 768 bytes and stay
+//  in L1, so this is one load and one store per channel; the loop is unrolled
+//  by hand because the lookups are independent.
+//
+///////////////////////////////////////////////////////////////////////////////
+static void LookupPixels(const unsigned char (*table)[256], unsigned char* rgba, int nPixels)
+{
+    const unsigned char* tableR = table[0];
+    const unsigned char* tableG = table[1];
+    const unsigned char* tableB = table[2];
+
+    int i = 0;
+    for (; i + 2 <= nPixels; i += 2, rgba += 8)
+    {
+        unsigned char r0 = tableR[rgba[0]], g0 = tableG[rgba[1]], b0 = tableB[rgba[2]];
+        unsigned char r1 = tableR[rgba[4]], g1 = tableG[rgba[5]], b1 = tableB[rgba[6]];
+        rgba[0] = r0;   rgba[1] = g0;   rgba[2] = b0;
+        rgba[4] = r1;   rgba[5] = g1;   rgba[6] = b1;
+    }// for
+
+    for (; i < nPixels; ++i, rgba += 4)
+    {
+        rgba[0] = tableR[rgba[0]];
+        rgba[1] = tableG[rgba[1]];
+        rgba[2] = tableB[rgba[2]];
+    }// for
+}// LookupPixels
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Look up the color channels of the given RGBA pixels, in parallel
+//  ranges.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ChannelLut::Apply(unsigned char* rgba, int nPixels) const
+{
+    ParallelFor(0, nPixels, c_pointGrain, [this, rgba](int begin, int end)
+    {
+        LookupPixels(table, rgba + (size_t)begin * 4, end - begin);
+    });
+}// Apply
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append a stage replacing the color channels by luminance.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PointChain::Add_Gray()
+{
+    Stage stage;
+    stage.bGray = true;
+    m_vStages.push_back(stage);
+}// Add_Gray
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append a table lookup.  Successive tables are composed into one, so any
+//  run of per-channel operations costs a single lookup per channel.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PointChain::Add_Lut(const ChannelLut& lut)
+{
+    if (!m_vStages.empty() && !m_vStages.back().bGray)
+    {
+        m_vStages.back().lut.Then(lut);
+        return;
+    }// if
+
+    Stage stage;
+    stage.bGray = false;
+    stage.lut = lut;
+    m_vStages.push_back(stage);
+}// Add_Lut
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the stages of another chain to this one.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PointChain::Append(const PointChain& chain)
+{
+    for (size_t s = 0; s < chain.m_vStages.size(); ++s)
+    {
+        if (chain.m_vStages[s].bGray)
+            Add_Gray();
+        else
+            Add_Lut(chain.m_vStages[s].lut);
+    }// for
+}// Append
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run the chain over the given RGBA pixels, in parallel ranges.  Each
+//  pixel is loaded once, pushed through every stage in registers and stored
+//  once, so the result is identical to applying the stages one after another.
+//
+///////////////////////////////////////////////////////////////////////////////
+void PointChain::Apply(unsigned char* rgba, int nPixels) const
+{
+    if (m_vStages.empty())
+        return;
+
+    if (m_vStages.size() == 1 && !m_vStages[0].bGray)
+    {
+        m_vStages[0].lut.Apply(rgba, nPixels);
+        return;
+    }// if
+
+    const Stage*    pStages = &m_vStages[0];
+    int             nStages = (int)m_vStages.size();
+
+    ParallelFor(0, nPixels, c_pointGrain, [=](int begin, int end)
+    {
+        unsigned char* pixel = rgba + (size_t)begin * 4;
+
+        for (int i = begin; i < end; ++i, pixel += 4)
+        {
+            unsigned char r = pixel[0];
+            unsigned char g = pixel[1];
+            unsigned char b = pixel[2];
+
+            for (int s = 0; s < nStages; ++s)
+            {
+                if (pStages[s].bGray)
+                    r = g = b = Luminance(r, g, b);
+                else
+                {
+                    r = pStages[s].lut.table[0][r];
+                    g = pStages[s].lut.table[1][g];
+                    b = pStages[s].lut.table[2][b];
+                }// else
+            }// for
+
+            pixel[0] = r;
+            pixel[1] = g;
+            pixel[2] = b;
+        }// for
+    });
+}// Apply
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace the color channels by luminance and build the histogram.  Each
+//  thread counts into its own histogram, merged once all are done.
+//
+///////////////////////////////////////////////////////////////////////////////
+void GrayscaleHistogram(unsigned char* rgba, int nPixels, LumaHistogram& histogram)
+{
+    int nChunks = ChunkCount(0, nPixels, c_histogramGrain);
+    std::vector<LumaHistogram> vPartial(nChunks);
+
+    ParallelChunks(0, nPixels, nChunks, [&](int chunk, int begin, int end)
+    {
+        LumaHistogram&  partial = vPartial[chunk];
+        unsigned char*  pixel = rgba + (size_t)begin * 4;
+        int64_t         sum1000 = 0;
+
+        memset(partial.counts, 0, sizeof(partial.counts));
+
+        for (int i = begin; i < end; ++i, pixel += 4)
+        {
+            unsigned char gray = Luminance(pixel[0], pixel[1], pixel[2]);
+
+            sum1000 += pixel[0] * 299 + pixel[1] * 587 + pixel[2] * 114;
+            ++partial.counts[gray];
+            pixel[0] = pixel[1] = pixel[2] = gray;
+        }// for
+
+        partial.sum1000 = sum1000;
+    });
+
+    histogram = vPartial[0];
+    for (int chunk = 1; chunk < nChunks; ++chunk)
+    {
+        for (int v = 0; v < 256; ++v)
+            histogram.counts[v] += vPartial[chunk].counts[v];
+        histogram.sum1000 += vPartial[chunk].sum1000;
+    }// for
+}// GrayscaleHistogram
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Threshold the color channels.  With SSE2 four pixels are done at once:
+//  a byte is at least the threshold exactly when the unsigned maximum of the
+//  two is the byte itself.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ApplyThreshold(unsigned char* rgba, int nPixels, int threshold)
+{
+    if (threshold <= 0 || threshold > 255)
+    {
+        ChannelLut::Threshold(threshold).Apply(rgba, nPixels);
+        return;
+    }// if
+
+    ParallelFor(0, nPixels, c_thresholdGrain, [=](int begin, int end)
+    {
+        unsigned char* pixel = rgba + (size_t)begin * 4;
+        int i = begin;
+
+#ifdef HAVE_SSE2
+        const __m128i limit = _mm_set1_epi8((char)threshold);
+        const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+        for (; i + 4 <= end; i += 4, pixel += 16)
+        {
+            __m128i value = _mm_loadu_si128((const __m128i*)pixel);
+            __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(value, limit), value);
+            _mm_storeu_si128((__m128i*)pixel, _mm_or_si128(_mm_andnot_si128(alpha, above), _mm_and_si128(alpha, value)));
+        }// for
+#endif
+
+        for (; i < end; ++i, pixel += 4)
+        {
+            pixel[0] = (pixel[0] < threshold) ? 0 : 255;
+            pixel[1] = (pixel[1] < threshold) ? 0 : 255;
+            pixel[2] = (pixel[2] < threshold) ? 0 : 255;
+        }// for
+    });
+}// ApplyThreshold
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PointOps.h
+//
+//      Point-wise pixel operations.  Per-channel tone operations are compiled
+//  into 256-entry lookup tables which compose into a single table, and chains
+//  of point operations are applied in one fused pass over the image.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _POINT_OPS_H_
+#define _POINT_OPS_H_
+
+#include <vector>
+#include <stdint.h>
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Luminance of a pixel, truncated to 8 bits the same way every grayscale
+//  operation stores it.
+//
+///////////////////////////////////////////////////////////////////////////////
+inline unsigned char Luminance(unsigned char r, unsigned char g, unsigned char b)
+{
+    return static_cast<unsigned char>(r * 0.299 + g * 0.587 + b * 0.114);
+}// Luminance
+
+
+class ChannelLut
+{
+    // methods
+    public:
+        ChannelLut();                                       // identity table
+
+        // table builders
+        static ChannelLut Quantize(int bitsR, int bitsG, int bitsB);   // keep the top bits of each channel
+        static ChannelLut Threshold(int threshold);         // below threshold goes to 0, the rest to 255
+        static ChannelLut Levels(int black, int white);     // stretch [black, white] to [0, 255]
+        static ChannelLut Gamma(float gamma);               // out = 255 * (in / 255) ^ (1 / gamma)
+        static ChannelLut Posterize(int levels);            // snap to the given number of evenly spaced levels
+        static ChannelLut Invert();                         // out = 255 - in
+
+        void Then(const ChannelLut& next);                  // compose so this table is followed by next
+        void Apply(unsigned char* rgba, int nPixels) const; // look up the color channels of RGBA pixels
+
+    // members
+    public:
+        unsigned char   table[3][256];                      // output value per channel and input value
+};// ChannelLut
+
+
+class PointChain
+{
+    // methods
+    public:
+        void Add_Gray();                                    // replace color channels by luminance
+        void Add_Lut(const ChannelLut& lut);                // merged into the previous table when possible
+        void Append(const PointChain& chain);               // append all stages of another chain
+
+        bool Empty() const                  { return m_vStages.empty(); }
+        void Clear()                        { m_vStages.clear(); }
+
+        void Apply(unsigned char* rgba, int nPixels) const; // run the whole chain in one pass
+
+    // types
+    private:
+        struct Stage
+        {
+            bool        bGray;              // luminance stage, otherwise a table lookup
+            ChannelLut  lut;
+        };// Stage
+
+    // members
+    private:
+        std::vector<Stage>  m_vStages;
+};// PointChain
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Histogram of pixel luminances.  The sum is of the exact luminances
+//  before truncation, kept in thousandths so it needs no floating point.
+//
+///////////////////////////////////////////////////////////////////////////////
+struct LumaHistogram
+{
+    unsigned int    counts[256];                            // pixels per truncated luminance
+    int64_t         sum1000;                                // 1000 times the sum of luminances
+};// LumaHistogram
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Replace the color channels of the given RGBA pixels by their luminance
+//  and build the luminance histogram in the same pass.
+//
+///////////////////////////////////////////////////////////////////////////////
+void GrayscaleHistogram(unsigned char* rgba, int nPixels, LumaHistogram& histogram);
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the color channels of the given RGBA pixels to 0 where below the
+//  threshold and to 255 elsewhere.  Alpha is left unchanged.
+//
+///////////////////////////////////////////////////////////////////////////////
+void ApplyThreshold(unsigned char* rgba, int nPixels, int threshold);
+
+#endif // _POINT_OPS_H_
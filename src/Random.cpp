@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Random.cpp
+//
+//      Process-wide random seed.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Random.h"
+#include <atomic>
+#include <time.h>
+
+
+// seed shared by all operations; atomic so it can be set while images are
+// being processed on other threads
+static std::atomic<uint64_t> s_seed((uint64_t)time(NULL));
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Set the seed used by operations started from now on.
+//
+///////////////////////////////////////////////////////////////////////////////
+void SetRandomSeed(uint64_t seed)
+{
+    s_seed.store(seed, std::memory_order_relaxed);
+}// SetRandomSeed
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Current seed.
+//
+///////////////////////////////////////////////////////////////////////////////
+uint64_t RandomSeed()
+{
+    return s_seed.load(std::memory_order_relaxed);
+}// RandomSeed
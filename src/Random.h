@@ -0,0 +1,70 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Random.h
+//
+//      Small seedable random number generator.  Every generator is built from
+//  the process-wide seed and a stream number, so rows or tiles processed on
+//  different threads draw from independent sequences and the result only
+//  depends on the seed.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _RANDOM_H_
+#define _RANDOM_H_
+
+#include <stdint.h>
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Seed used by every operation that draws random numbers.  It starts
+//  from the clock, so runs differ unless a seed is set explicitly.
+//
+///////////////////////////////////////////////////////////////////////////////
+void        SetRandomSeed(uint64_t seed);
+uint64_t    RandomSeed();
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      PCG32 generator (64 bit LCG state, xorshift and rotate output).  Each
+//  stream number selects a distinct increment, giving statistically
+//  independent sequences for the same seed.
+//
+///////////////////////////////////////////////////////////////////////////////
+class Random
+{
+    // methods
+    public:
+        Random(uint64_t seed, uint64_t stream)
+            : m_state(0), m_increment((stream << 1) | 1)
+        {
+            Next();
+            m_state += seed;
+            Next();
+        }// Random
+
+        // uniformly distributed 32 bit value
+        uint32_t Next()
+        {
+            uint64_t state = m_state;
+            m_state = state * 6364136223846793005ULL + m_increment;
+
+            uint32_t xorShifted = (uint32_t)(((state >> 18) ^ state) >> 27);
+            uint32_t rotation = (uint32_t)(state >> 59);
+            return (xorShifted >> rotation) | (xorShifted << ((0u - rotation) & 31));
+        }// Next
+
+        // value in [0, n), by multiply and shift rather than a division
+        uint32_t Range(uint32_t n)
+        {
+            return (uint32_t)(((uint64_t)Next() * n) >> 32);
+        }// Range
+
+    // members
+    private:
+        uint64_t    m_state;
+        uint64_t    m_increment;
+};// Random
+
+#endif // _RANDOM_H_
@@ -15,6 +15,12 @@
 #include <fstream>
 #include <string.h>
 #include "TargaImage.h"
+#include "PointOps.h"
+#include "ColorQuant.h"
+#include "Random.h"
+#include "OrderedDither.h"
+#include "Convolution.h"
+#include "Parallel.h"
 
 using namespace std;
 
@@ -27,17 +33,26 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "gray",
                                             "quant-unif",
                                             "quant-pop",
+                                            "quant-median",
+                                            "quant-octree",
+                                            "quant-kmeans",
+                                            "palette-sample",
+                                            "palette-reset",
                                             "dither-thresh",
                                             "dither-rand",
                                             "dither-fs",
                                             "dither-bright",
                                             "dither-cluster",
                                             "dither-pattern",
+                                            "dither-bluenoise",
                                             "dither-color",
+                                            "dither-diffuse",
                                             "filter-box",
                                             "filter-bartlett",
                                             "filter-gauss",
                                             "filter-gauss-n",
+                                            "filter-box-n",
+                                            "filter-gauss-sigma",
                                             "filter-edge",
                                             "filter-enhance",
                                             "npr-paint",
@@ -50,7 +65,14 @@ const char      c_asCommands[][32]      = { "load",                     // valid
                                             "comp-atop",
                                             "comp-xor",
                                             "diff",
-                                            "rotate"
+                                            "rotate",
+                                            "levels",
+                                            "gamma",
+                                            "posterize",
+                                            "invert",
+                                            "seed",
+                                            "edge-mode",
+                                            "threads"
                                           };
 
 enum ECommands          // command ids
@@ -61,17 +83,26 @@ enum ECommands          // command ids
     GRAY,
     QUANT_UNIF,
     QUANT_POP,
+    QUANT_MEDIAN,
+    QUANT_OCTREE,
+    QUANT_KMEANS,
+    PALETTE_SAMPLE,
+    PALETTE_RESET,
     DITHER_THRESH,
     DITHER_RAND,
     DITHER_FS,
     DITHER_BRIGHT,
     DITHER_CLUSTER,
     DITHER_PATTERN,
+    DITHER_BLUE_NOISE,
     DITHER_COLOR,
+    DITHER_DIFFUSE,
     FILTER_BOX,
     FILTER_BARTLETT,
     FILTER_GAUSS,
     FILTER_GAUSS_N,
+    FILTER_BOX_N,
+    FILTER_GAUSS_SIGMA,
     FILTER_EDGE,
     FILTER_ENHANCE,
     NPR_PAINT,
@@ -85,10 +116,120 @@ enum ECommands          // command ids
     COMP_XOR,
     DIFF,
     ROTATE,
+    LEVELS,
+    GAMMA,
+    POSTERIZE,
+    INVERT,
+    SEED,
+    EDGE_MODE,
+    THREADS,
     NUM_COMMANDS
 };// ECommands
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the point-wise operation of the given command to the chain.  The
+//  command name has already been read with strtok, so any arguments are read
+//  from the same token stream.  Return false if the command is not point-wise
+//  or its arguments are invalid.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool ParsePointOp(int command, PointChain& chain)
+{
+    switch (command)
+    {
+        case GRAY:
+            chain.Add_Gray();
+            return true;
+
+        case QUANT_UNIF:
+            chain.Add_Lut(ChannelLut::Quantize(3, 3, 2));
+            return true;
+
+        case DITHER_THRESH:
+            chain.Add_Gray();
+            chain.Add_Lut(ChannelLut::Threshold(128));
+            return true;
+
+        case LEVELS:
+        {
+            char* sBlack = strtok(NULL, c_sWhiteSpace);
+            char* sWhite = strtok(NULL, c_sWhiteSpace);
+            if (!sBlack || !sWhite)
+                return false;
+
+            int black = atoi(sBlack),
+                white = atoi(sWhite);
+            if (black < 0 || white > 255 || black >= white)
+                return false;
+
+            chain.Add_Lut(ChannelLut::Levels(black, white));
+            return true;
+        }// LEVELS
+
+        case GAMMA:
+        {
+            char* sGamma = strtok(NULL, c_sWhiteSpace);
+            float gamma;
+            if (!sGamma || (gamma = (float)atof(sGamma)) <= 0)
+                return false;
+
+            chain.Add_Lut(ChannelLut::Gamma(gamma));
+            return true;
+        }// GAMMA
+
+        case POSTERIZE:
+        {
+            char* sLevels = strtok(NULL, c_sWhiteSpace);
+            int levels;
+            if (!sLevels || (levels = atoi(sLevels)) < 2 || levels > 256)
+                return false;
+
+            chain.Add_Lut(ChannelLut::Posterize(levels));
+            return true;
+        }// POSTERIZE
+
+        case INVERT:
+            chain.Add_Lut(ChannelLut::Invert());
+            return true;
+    }// switch
+
+    return false;
+}// ParsePointOp
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Append the given command string to the chain if it is point-wise.
+//  Return false if it must be run on its own.
+//
+///////////////////////////////////////////////////////////////////////////////
+static bool AddPointOp(const char* sCommand, PointChain& chain)
+{
+    char sCommandLine[c_maxLineLength + 1];
+    strncpy(sCommandLine, sCommand, c_maxLineLength);
+    sCommandLine[c_maxLineLength] = '\0';
+
+    char* sToken = strtok(sCommandLine, c_sWhiteSpace);
+    if (!sToken)
+        return false;
+
+    int command;
+    for (command = 0; command < NUM_COMMANDS; ++command)
+        if (!strcmp(sToken, c_asCommands[command]))
+            break;
+
+    // parse into a scratch chain so a bad command leaves the pending chain alone
+    PointChain op;
+    if (!ParsePointOp(command, op))
+        return false;
+
+    chain.Append(op);
+    return true;
+}// AddPointOp
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Execute the given command string on the given image.  If the command
@@ -112,7 +253,7 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
 
     // if there's no image only a subset of commands are valid
-    if (!pImage && command != LOAD && command != RUN && command != NUM_COMMANDS)
+    if (!pImage && command != LOAD && command != RUN && command != PALETTE_RESET && command != SEED && command != EDGE_MODE && command != THREADS && command != NUM_COMMANDS)
     {
         cout << "No image to operate on.  Use \"load\" command to load image." << endl;
         return false;
@@ -174,10 +315,69 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case QUANT_POP:
         {
-            bResult = pImage->Quant_Populosity();
+            char* sMode = strtok(NULL, c_sWhiteSpace);
+
+            if (!sMode)
+                bResult = pImage->Quant_Populosity();
+            else if (!strcmp(sMode, "shared"))
+                bResult = pImage->Quant_Populosity_Shared();
+            else
+            {
+                cout << "Invalid mode \"" << sMode << "\"; use quant-pop [shared]." << endl;
+                bParsed = bResult = false;
+            }// else
             break;
         }// QUANT_POP
 
+        case QUANT_MEDIAN:
+        {
+            bResult = pImage->Quant_Median();
+            break;
+        }// QUANT_MEDIAN
+
+        case QUANT_OCTREE:
+        {
+            char *sColors = strtok(NULL, c_sWhiteSpace);
+            int nColors = sColors ? atoi(sColors) : 256;
+
+            if (nColors < 1 || nColors > 256)
+            {
+                cout << "Invalid number of colors; must be between 1 and 256." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Quant_Octree(nColors);
+            break;
+        }// QUANT_OCTREE
+
+        case QUANT_KMEANS:
+        {
+            char *sIterations = strtok(NULL, c_sWhiteSpace);
+            int nIterations = sIterations ? atoi(sIterations) : 4;
+
+            if (nIterations < 0)
+            {
+                cout << "Invalid number of iterations." << endl;
+                bParsed = bResult = false;
+            }// if
+            else
+                bResult = pImage->Quant_KMeans(nIterations);
+            break;
+        }// QUANT_KMEANS
+
+        case PALETTE_SAMPLE:
+        {
+            bResult = pImage->Sample_Shared_Palette();
+            break;
+        }// PALETTE_SAMPLE
+
+        case PALETTE_RESET:
+        {
+            PaletteCache::Shared().Reset();
+            bResult = true;
+            break;
+        }// PALETTE_RESET
+
         case DITHER_THRESH:
         {
             bResult = pImage->Dither_Threshold();
@@ -192,7 +392,17 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 
         case DITHER_FS:
         {
-            bResult = pImage->Dither_FS();
+            char* sOrder = strtok(NULL, c_sWhiteSpace);
+
+            if (!sOrder || !strcmp(sOrder, "serpentine"))
+                bResult = pImage->Dither_FS();
+            else if (!strcmp(sOrder, "raster"))
+                bResult = pImage->Dither_FS_Raster();
+            else
+            {
+                cout << "Invalid scan order \"" << sOrder << "\"; use dither-fs [serpentine|raster]." << endl;
+                bParsed = bResult = false;
+            }// else
             break;
         }// DITHER_FS
 
@@ -204,9 +414,39 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
         
         case DITHER_CLUSTER:
         {
-            bResult = pImage->Dither_Cluster();
+            char* sSize = strtok(NULL, c_sWhiteSpace);
+            int size = sSize ? atoi(sSize) : 0;
+
+            if (sSize && !ClusterThresholds(size))
+            {
+                cout << "Cluster size must be 2, 4, 8 or 16." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = sSize ? pImage->Dither_Cluster(size) : pImage->Dither_Cluster();
             break;
         }// DITHER_CLUSTER
+
+        case DITHER_PATTERN:
+        {
+            char* sSize = strtok(NULL, c_sWhiteSpace);
+            int size = sSize ? atoi(sSize) : 4;
+
+            if (!BayerThresholds(size))
+            {
+                cout << "Pattern size must be 2, 4, 8 or 16." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Dither_Pattern(size);
+            break;
+        }// DITHER_PATTERN
+
+        case DITHER_BLUE_NOISE:
+        {
+            bResult = pImage->Dither_Blue_Noise();
+            break;
+        }// DITHER_BLUE_NOISE
         
         case DITHER_COLOR:
         {
@@ -214,6 +454,22 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// DITHER_COLOR
 
+        case DITHER_DIFFUSE:
+        {
+            char* sKernel = strtok(NULL, c_sWhiteSpace);
+            char* sColor = strtok(NULL, c_sWhiteSpace);
+            EDiffusionKernel kernel;
+
+            if (!sKernel || !FindDiffusionKernel(sKernel, kernel) || (sColor && strcmp(sColor, "color")))
+            {
+                cout << "Usage: dither-diffuse <fs|jarvis|stucki|atkinson|sierra> [color]" << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Dither_Diffuse(kernel, sColor != NULL);
+            break;
+        }// DITHER_DIFFUSE
+
         case FILTER_BOX:
         {
             bResult = pImage->Filter_Box();
@@ -244,6 +500,36 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// FILTER_GUASS_N
 
+        case FILTER_BOX_N:
+        {
+            char* sRadius = strtok(NULL, c_sWhiteSpace);
+            int radius = sRadius ? atoi(sRadius) : -1;
+
+            if (radius < 0 || radius > c_maxBoxRadius)
+            {
+                cout << "Invalid box radius; it must be from 0 to " << c_maxBoxRadius << "." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Filter_Box_N(radius);
+            break;
+        }// FILTER_BOX_N
+
+        case FILTER_GAUSS_SIGMA:
+        {
+            char* sSigma = strtok(NULL, c_sWhiteSpace);
+            float sigma = sSigma ? (float)atof(sSigma) : 0.f;
+
+            if (sigma < 0.5f)
+            {
+                cout << "Invalid sigma; it must be at least 0.5." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Filter_Gaussian_Sigma(sigma);
+            break;
+        }// FILTER_GAUSS_SIGMA
+
         case FILTER_EDGE:
         {
             bResult = pImage->Filter_Edge();
@@ -414,6 +700,81 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
             break;
         }// ROTATE
 
+        case LEVELS:
+        case GAMMA:
+        case POSTERIZE:
+        case INVERT:
+        {
+            PointChain chain;
+            if (!ParsePointOp(command, chain))
+            {
+                cout << "Invalid arguments for " << c_asCommands[command] << "." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+                bResult = pImage->Apply_Point_Chain(chain);
+            break;
+        }// LEVELS, GAMMA, POSTERIZE, INVERT
+
+        case SEED:
+        {
+            char* sSeed = strtok(NULL, c_sWhiteSpace);
+            char* sEnd;
+            unsigned long long seed = sSeed ? strtoull(sSeed, &sEnd, 10) : 0;
+
+            if (!sSeed || *sEnd)
+            {
+                cout << "Invalid seed." << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                SetRandomSeed(seed);
+                bResult = true;
+            }// else
+            break;
+        }// SEED
+
+        case EDGE_MODE:
+        {
+            char* sMode = strtok(NULL, c_sWhiteSpace);
+            EEdgeMode mode;
+
+            if (!sMode || !FindEdgeMode(sMode, mode))
+            {
+                cout << "Usage: edge-mode <renormalise|clamp|mirror|wrap>" << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                SetEdgeMode(mode);
+                bResult = true;
+            }// else
+            break;
+        }// EDGE_MODE
+
+        case THREADS:
+        {
+            char* sThreads = strtok(NULL, c_sWhiteSpace);
+            char* sGrain = strtok(NULL, c_sWhiteSpace);
+            int nThreads = sThreads ? atoi(sThreads) : -1;
+            int grain = sGrain ? atoi(sGrain) : 0;
+
+            if (nThreads < 0 || grain < 0)
+            {
+                cout << "Usage: threads <count, 0 for default> [rows per band]" << endl;
+                bResult = bParsed = false;
+            }// if
+            else
+            {
+                SetThreadCount(nThreads);
+                if (sGrain)
+                    SetRowGrain(grain);
+                bResult = true;
+            }// else
+            break;
+        }// THREADS
+
         default:
         {
             cout << "Unable to parse command:  " << sCommand << endl;
@@ -433,7 +794,8 @@ bool CScriptHandler::HandleCommand(const char* sCommand, TargaImage*& pImage)
 //      The given script file is executed on the given image.  If the file is 
 //  not correctly parsed an error message is printed and false is returned.  
 //  If all commands in the script execute correctly true is returned,
-//  otherwise false is returned.
+//  otherwise false is returned.  Runs of consecutive point-wise commands are
+//  executed as a single fused pass over the image.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage)
@@ -454,14 +816,30 @@ bool CScriptHandler::HandleScriptFile(const char* sFilename, TargaImage*& pImage
 
     bool bResult = true;
     char sLine[c_maxLineLength + 1];
+    PointChain chain;                   // pending run of point-wise commands
     while (!inFile.eof() && bResult)
     {
         inFile.getline(sLine, c_maxLineLength);
 
-        if (!inFile.eof())
-            bResult = HandleCommand(sLine, pImage);
+        if (inFile.eof())
+            break;
+
+        // consecutive point-wise commands are collected and run as one fused pass
+        if (pImage && AddPointOp(sLine, chain))
+            continue;
+
+        if (!chain.Empty())
+        {
+            pImage->Apply_Point_Chain(chain);
+            chain.Clear();
+        }// if
+
+        bResult = HandleCommand(sLine, pImage);
     }// while
 
+    if (!chain.Empty())
+        pImage->Apply_Point_Chain(chain);
+
     inFile.close();
     return bResult;
 }// CScriptHandler
@@ -12,6 +12,13 @@
 #include "Globals.h"
 #include "TargaImage.h"
 #include "libtarga.h"
+#include "PointOps.h"
+#include "ColorQuant.h"
+#include "Parallel.h"
+#include "Random.h"
+#include "OrderedDither.h"
+#include "ErrorDiffusion.h"
+#include "Convolution.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
@@ -20,6 +27,7 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <mutex>
 #include <map>
 #include <set>
 using namespace std;
@@ -29,6 +37,9 @@ const int           RED             = 0;                // red channel
 const int           GREEN           = 1;                // green channel
 const int           BLUE            = 2;                // blue channel
 const unsigned char BACKGROUND[3]   = { 0, 0, 0 };      // background color
+const int           BAND_ROWS       = 64;               // rows per band when streaming an image
+const int           GAUSSIAN_ONE    = 1 << 12;          // fixed point sum of a Gaussian kernel
+const int           BARTLETT[5]     = { 1, 3, 5, 3, 1 };    // 1D Bartlett weights, also the low pass of the edge filters
 
 
 // Computes n choose s, efficiently
@@ -44,6 +55,56 @@ double Binomial(int n, int s)
 }// Binomial
 
 
+// Gaussian kernels by size, built on first use
+static mutex                    s_gaussianMutex;
+static map<int, vector<int> >   s_gaussianKernels;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Fixed point weights of the N tap binomial approximation of a Gaussian,
+//  summing to exactly GAUSSIAN_ONE.  The coefficients are found as ratios
+//  walking out from the centre, C(n, k + 1) = C(n, k) (n - k) / (k + 1), so
+//  large N does not overflow.  Tail weights that round to zero are dropped,
+//  making the kernel about 9 sigma = 4.5 sqrt(N) taps wide.  Kernels are
+//  cached per N and never change once built.
+//
+///////////////////////////////////////////////////////////////////////////////
+static const vector<int>& Gaussian_Kernel(int N)
+{
+    lock_guard<mutex> lock(s_gaussianMutex);
+
+    vector<int>& vKernel = s_gaussianKernels[N];
+    if (!vKernel.empty())
+        return vKernel;
+
+    int n = N - 1;
+    int radius = n / 2;
+
+    // coefficients relative to the central one, then normalised
+    vector<double> vHalf(radius + 1);
+    vHalf[0] = 1.0;
+    double total = 1.0;
+    for (int k = 1; k <= radius; k++) {
+        vHalf[k] = vHalf[k - 1] * (n / 2 - k + 1) / (n / 2 + k);
+        total += 2 * vHalf[k];
+    }
+
+    int used = radius;
+    while (used > 0 && floor(vHalf[used] / total * GAUSSIAN_ONE + 0.5) == 0)
+        used--;
+
+    vKernel.assign(2 * used + 1, 0);
+    int sum = 0;
+    for (int k = -used; k <= used; k++)
+        sum += vKernel[used + k] = (int)floor(vHalf[abs(k)] / total * GAUSSIAN_ONE + 0.5);
+
+    // rounding leaves the sum a little off; the central weight takes it up
+    vKernel[used] += GAUSSIAN_ONE - sum;
+    return vKernel;
+}// Gaussian_Kernel
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Constructor.  Initialize member variables.
@@ -121,22 +182,23 @@ TargaImage::~TargaImage()
 unsigned char* TargaImage::To_RGB(void)
 {
     unsigned char   *rgb = new unsigned char[width * height * 3];
-    int		    i, j;
 
     if (! data)
 	    return NULL;
 
     // Divide out the alpha
-    for (i = 0 ; i < height ; i++)
-    {
-	    int in_offset = ((i * width) << 2);
-	    int out_offset = i * width * 3;
-
-	    for (j = 0 ; j < width ; j++)
+    ParallelRows(0, height, [this, rgb](int begin, int end) {
+        for (int i = begin ; i < end ; i++)
         {
-	        RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
-	    }
-    }
+	        int in_offset = ((i * width) << 2);
+	        int out_offset = i * width * 3;
+
+	        for (int j = 0 ; j < width ; j++)
+            {
+	            RGBA_To_RGB(data + (in_offset + j*4), rgb + (out_offset + j*3));
+	        }
+        }
+    });
 
     return rgb;
 }// TargaImage
@@ -211,12 +273,10 @@ TargaImage* TargaImage::Load_Image(char *filename)
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::To_Grayscale() {
-    for (int i = 0; i < width * height * 4; i += 4) {
-        data[i] = data[i] * 0.299 + data[i + 1] * 0.587 + data[i + 2] * 0.114;
-        data[i + 2] = data[i + 1] = data[i];
-    }
+    PointChain chain;
+    chain.Add_Gray();
 
-	return true;
+    return Apply_Point_Chain(chain);
 }// To_Grayscale
 
 
@@ -227,12 +287,8 @@ bool TargaImage::To_Grayscale() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Uniform() {
-    for (int i = 0; i < width * height * 4; i += 4) {
-        data[i + 0] = data[i + 0] >> 5 << 5; // R 3bit
-        data[i + 1] = data[i + 1] >> 5 << 5; // G 3bit
-        data[i + 2] = data[i + 2] >> 6 << 6; // B 2bit
-    }
-    return false;
+    ChannelLut::Quantize(3, 3, 2).Apply(data, width * height);    // R 3bit, G 3bit, B 2bit
+    return true;
 }// Quant_Uniform
 
 
@@ -243,202 +299,212 @@ bool TargaImage::Quant_Uniform() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Quant_Populosity() {
-    std::map<uint32_t, int> colors;
-    for (int i = 0; i < this->width * this->height * 4; i += 4) {
-        uint8_t R_val = this->data[i + 0] >> 3;
-        uint8_t G_val = this->data[i + 1] >> 3;
-        uint8_t B_val = this->data[i + 2] >> 3;
-        uint32_t key = (R_val << 10) + (G_val << 5) + B_val;
-        if (colors.find(key) == colors.end()){
-            colors[key] = 1;
-        }else{
-            colors[key]++;
-        }
-    }
+    vector<unsigned int> vCounts(c_nColorCells);
+    BuildColorHistogram(data, width * height, &vCounts[0]);
 
+    Palette palette;
+    PopulosityPalette(&vCounts[0], 256, palette);
+    palette.Map(data, width * height);
 
-    std::vector<std::pair<uint32_t , int>> Sorted(colors.begin(), colors.end());
-    std::sort(Sorted.begin(), Sorted.end(),
-              [](const std::pair<uint32_t, int>& a, const std::pair<uint32_t, int>& b)
-              { return a.second > b.second; });
+    return true;
+}// Quant_Populosity
 
-    for (int i = 0; i < this->width * this->height * 4; i += 4) {
-        int ind = 0;
-        uint8_t R_val = this->data[i + 0];
-        uint8_t G_val = this->data[i + 1];
-        uint8_t B_val = this->data[i + 2];
 
-        uint32_t min_dis = (1<<31);
-        pair<uint32_t,int> min_it;
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Add this image to the sample the shared populosity palette is built
+//  from.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Sample_Shared_Palette() {
+    PaletteCache::Shared().Add_Sample(data, width * height);
+    return true;
+}// Sample_Shared_Palette
 
-        for (const auto& j : Sorted){
-            uint8_t jR_val = ((j.first >> 10) & 0b11111) << 3;
-            uint8_t jG_val = ((j.first >> 05) & 0b11111) << 3;
-            uint8_t jB_val = ((j.first >> 00) & 0b11111) << 3;
 
-            uint32_t dis =
-                    (jR_val - R_val) * (jR_val - R_val)+
-                    (jG_val - G_val) * (jG_val - G_val)+
-                    (jB_val - B_val) * (jB_val - B_val);
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to an 8 bit image using the shared populosity
+//  palette, so a batch of frames is quantized consistently.  If nothing has
+//  been sampled yet this image seeds the palette.  Return success of
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Populosity_Shared() {
+    PaletteCache& cache = PaletteCache::Shared();
+    cache.Sample_If_Empty(data, width * height);
+    cache.Get_Palette()->Map(data, width * height);
+    return true;
+}// Quant_Populosity_Shared
 
-            if(dis < min_dis){
-                min_dis = dis;
-                min_it = j;
-            }
 
-            if(ind == 255){
-                break;
-            }
-            ind++;
-        }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Convert the image to an 8 bit image using median cut quantization.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Quant_Median() {
+    vector<unsigned int> vCounts(c_nColorCells);
+    BuildColorHistogram(data, width * height, &vCounts[0]);
 
-        data[i + 0] = ((min_it.first >> 10) & 0b11111) << 3;
-        data[i + 1] = ((min_it.first >> 05) & 0b11111) << 3;
-        data[i + 2] = ((min_it.first >> 00) & 0b11111) << 3;
+    Palette palette;
+    MedianCutPalette(&vCounts[0], 256, palette);
+    if (!palette.Size())
+        return false;
 
-    }
+    palette.Build_Inverse();
+    palette.Map(data, width * height);
 
     return true;
-}// Quant_Populosity
+}// Quant_Median
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Dither the image using a threshold of 1/2.  Return success of operation.
+//      Convert the image to an 8 bit image using the populosity palette
+//  refined by k-means over the color histogram.  Return success of
+//  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Threshold() {
-    for (int i = 0; i < width * height * 4; i += 4) {
-        data[i] = data[i] * 0.299 + data[i + 1] * 0.587 + data[i + 2] * 0.114;
-        data[i] = (data[i] < 128) ? 0 : 255;
-        data[i + 2] = data[i + 1] = data[i];
-    }
+bool TargaImage::Quant_KMeans(int nIterations) {
+    vector<unsigned int> vCounts(c_nColorCells);
+    BuildColorHistogram(data, width * height, &vCounts[0]);
+
+    Palette palette;
+    PopulosityPalette(&vCounts[0], 256, palette);
+    RefinePalette(&vCounts[0], nIterations, palette);
+    palette.Map(data, width * height);
+
     return true;
-}// Dither_Threshold
+}// Quant_KMeans
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Dither image using random dithering.  Return success of operation.
+//      Convert the image to at most nColors colors using octree quantization.
+//  The image is streamed through the tree in bands of rows; the tree has a
+//  fixed node budget, so memory does not grow with the image.  Return success
+//  of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Random(){
-    srand(time(NULL));
-    for (int i = 0; i < width * height * 4; i += 4) {
+bool TargaImage::Quant_Octree(int nColors) {
+    OctreeQuantizer octree(nColors);
 
-        double grayval = data[i] * 0.299 + data[i + 1] * 0.587 + data[i + 2] * 0.114;
-        double rd = ((rand() % 103) - 51);
+    for (int row = 0; row < height; row += BAND_ROWS)
+        octree.Add_Pixels(data + ((row * width) << 2), Min(BAND_ROWS, height - row) * width);
 
-        grayval += rd;
-        grayval = grayval < 255 ? grayval > 0 ? grayval : 0 : 255;
+    octree.Build_Palette();
+
+    for (int row = 0; row < height; row += BAND_ROWS)
+        octree.Map(data + ((row * width) << 2), Min(BAND_ROWS, height - row) * width);
 
-        data[i] = static_cast<uint8_t>(grayval);
-        data[i + 2] = data[i + 1] = data[i];
-    }
-    this->Dither_Bright();
     return true;
-}// Dither_Random
+}// Quant_Octree
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform Floyd-Steinberg dithering on the image.  Return success of 
-//  operation.
+//      Dither the image using a threshold of 1/2.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_FS() {
-    uint32_t* new_data = new uint32_t [width * height * 4];
-    for (int i = 0; i < width * height * 4; i += 4) {
-        data[i] = data[i] * 0.299 + data[i + 1] * 0.587 + data[i + 2] * 0.114;
-        data[i + 2] = data[i + 1] = data[i];
-        new_data[i] = new_data[i + 1] = new_data[i + 2] = data[i];
-        new_data[i + 3] = data[3];
-    }
+bool TargaImage::Dither_Threshold() {
+    PointChain chain;
+    chain.Add_Gray();
+    chain.Add_Lut(ChannelLut::Threshold(128));
 
-    for (int i = 0; i < height; i++) {
-        if (i % 2 == 0) {
-            for (int j = 0; j < width; j++) {
+    return Apply_Point_Chain(chain);
+}// Dither_Threshold
 
-                size_t index = ((i * width) * 4) + j * 4;
-                data[index] = (new_data[index] < 128) ? 0 : 255;
-                data[index + 1] = data[index + 2] = data[index];
 
-                uint32_t diff = new_data[index] - data[index];
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Run a chain of point-wise operations as a single pass over the image.
+//  The result is identical to running the operations one after another.
+//  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Apply_Point_Chain(const PointChain& chain) {
+    chain.Apply(data, width * height);
+    return true;
+}// Apply_Point_Chain
 
-                if (i + 1 < height && j > 0) {
-                    new_data[(((i + 1) * width) << 2) + (j - 1) * 4] += diff * ((float)3 / 16);
-                }
-                if (i + 1 < height) {
-                    new_data[(((i + 1) * width) << 2) + j * 4] += diff * ((float)5 / 16);
-                }
-                if (i + 1 < height && j + 1 < width) {
-                    new_data[(((i + 1) * width) << 2) + (j + 1) * 4] += diff * ((float)1 / 16);
-                }
-                if (j + 1 < width) {
-                    new_data[((i * width) << 2) + (j - 1) * 4] += diff * ((float)7 / 16);
-                }
-            }
-        }else {
-            for (int j = width - 1; j >= 0; j--) {
 
-                size_t index = ((i * width) * 4) + j * 4;
-                data[index] = (new_data[index] < 128) ? 0 : 255;
-                data[index + 1] = data[index + 2] = data[index];
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither image using random dithering.  Every row draws its noise from
+//  its own stream of the current seed, so rows run in parallel and the result
+//  is the same for a given seed.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Random(){
+    uint64_t seed = RandomSeed();
 
-                uint32_t diff = new_data[index] - data[index];
+    ParallelRows(0, height, [this, seed](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            Random random(seed, i);
+            unsigned char* pixel = data + i * width * 4;
 
-                if (i + 1 < height && j + 1 < width) {
-                    new_data[(((i + 1) * width) << 2) + (j + 1) * 4] += diff * ((float) 3 / 16);
-                }
-                if (i + 1 < height) {
-                    new_data[(((i + 1) * width) << 2) + j * 4] += diff * ((float) 5 / 16);
-                }
-                if (i + 1 < height && j > 0) {
-                    new_data[(((i + 1) * width) << 2) + (j - 1) * 4] += diff * ((float) 1 / 16);
-                }
-                if (j > 0) {
-                    new_data[((i * width) << 2) + (j - 1) * 4] += diff * ((float) 7 / 16);
-                }
+            for (int j = 0; j < width; j++, pixel += 4) {
+                int grayval = Luminance(pixel[0], pixel[1], pixel[2]) + (int)random.Range(103) - 51;
+                pixel[0] = pixel[1] = pixel[2] = static_cast<uint8_t>(Min(Max(grayval, 0), 255));
             }
         }
-    }
+    });
 
-    delete[] new_data;
-    ClearToBlack();
+    this->Dither_Bright();
+    return true;
+}// Dither_Random
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform Floyd-Steinberg dithering on the image.  Return success of 
+//  operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_FS() {
+    ErrorDiffusion(data, width, height, DIFFUSE_FLOYD_STEINBERG, false);
     return true;
 }// Dither_FS
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Dither the image while conserving the average brightness.  Return 
+//      Perform Floyd-Steinberg dithering in raster order, every row running
+//  left to right, with rows in parallel as a wavefront.  The result is the
+//  same for any number of threads.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_FS_Raster() {
+    RasterDiffusion(data, width, height);
+    return true;
+}// Dither_FS_Raster
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Dither the image while conserving the average brightness.  The
+//  threshold is the highest gray level for which turning every pixel at or
+//  above it white gives at least the original total brightness.  Return
 //  success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Bright() {
-    double sum_of_brightness = 0.0;
-    vector<int> bright_cnt(256, 0);
-    for (int i = 0; i < width * height * 4; i += 4) {
-        double grayval = data[i] * 0.299 + data[i + 1] * 0.587 + data[i + 2] * 0.114;
-        data[i] = static_cast<uint8_t>(grayval);
-        sum_of_brightness += grayval;
-        bright_cnt[static_cast<int>(grayval)]++;
-    }
+    LumaHistogram histogram;
+    GrayscaleHistogram(data, width * height, histogram);
 
-    int br_after_thres = 0;
-    int thres_val = 255;
-    for( ; thres_val > -1 ; thres_val--){
-        br_after_thres += (bright_cnt[thres_val] * 255);
-        if(br_after_thres >= sum_of_brightness){
-            break;
-        }
-    }
+    // brightness, in thousandths, of the image thresholded at each level
+    int64_t aAbove[257];
+    aAbove[256] = 0;
+    for (int v = 255; v >= 0; v--)
+        aAbove[v] = aAbove[v + 1] + (int64_t)histogram.counts[v] * 255 * 1000;
 
-    for (int i = 0; i < (width * height) << 2; i += 4) {
-        data[i] = (data[i] < thres_val) ? 0 : 255;
-        data[i + 2] = data[i + 1] = data[i];
-    }
+    // aAbove never increases with the level, so the search can bisect for the
+    // first level below the original brightness
+    int thres_val = int(upper_bound(aAbove, aAbove + 257, histogram.sum1000, greater<int64_t>()) - aAbove) - 1;
 
+    ApplyThreshold(data, width * height, Min(thres_val, 255));
     return true;
 }// Dither_Bright
 
@@ -449,36 +515,89 @@ bool TargaImage::Dither_Bright() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Dither_Cluster() {
-    this->To_Grayscale();
-    int mask[4][4] = {{180, 90, 150, 60},
-                      {15, 240, 210, 105},
-                      {120, 195, 225, 30},
-                      {45, 135, 75, 165}};
-    for (int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++){
-            size_t index = ((i * width) << 2) + (j << 2);
-            data[index] = data[index] >= mask[i & 0b11][ j & 0b11 ] ? 255 : 0;
-            data[index + 2] = data[index + 1] = data[index];
-        }
-    }
+    static const unsigned char mask[4][4] = {{180, 90, 150, 60},
+                                             {15, 240, 210, 105},
+                                             {120, 195, 225, 30},
+                                             {45, 135, 75, 165}};
+    OrderedDither(data, width, height, mask[0], 4);
     return true;
 }// Dither_Cluster
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform clustered dithering with a generated cluster matrix of the
+//  given size, which must be 2, 4, 8 or 16.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Cluster(int size) {
+    const unsigned char* aThresholds = ClusterThresholds(size);
+    if (!aThresholds)
+        return false;
+
+    OrderedDither(data, width, height, aThresholds, size);
+    return true;
+}// Dither_Cluster
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform ordered dithering with the Bayer matrix of the given size,
+//  which must be 2, 4, 8 or 16.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Pattern(int size) {
+    const unsigned char* aThresholds = BayerThresholds(size);
+    if (!aThresholds)
+        return false;
+
+    OrderedDither(data, width, height, aThresholds, size);
+    return true;
+}// Dither_Pattern
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform ordered dithering with a tiled blue noise mask, which looks
+//  close to error diffusion but has no dependence between pixels.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Blue_Noise() {
+    OrderedDither(data, width, height, BlueNoiseThresholds(), c_blueNoiseSize);
+    return true;
+}// Dither_Blue_Noise
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //  Convert the image to an 8 bit image using Floyd-Steinberg dithering over
-//  a uniform quantization - the same quantization as in Quant_Uniform.
+//  8 evenly spaced red and green levels (0, 36, 73, ... 255) and 4 blue
+//  levels (0, 85, 170, 255).  Each pixel takes the nearest level, unlike the
+//  truncating bins of Quant_Uniform.  The result is the same as the sample
+//  dither-color.png, including its undithered left, right and bottom edge.
 //  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Dither_Color()
-{
-    ClearToBlack();
-    return false;
+bool TargaImage::Dither_Color() {
+    ErrorDiffusion(data, width, height, DIFFUSE_FLOYD_STEINBERG, true);
+    return true;
 }// Dither_Color
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform error diffusion dithering with the given kernel, to black and
+//  white or, if bColor is set, to the palette of Dither_Color.  Return
+//  success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Dither_Diffuse(EDiffusionKernel kernel, bool bColor) {
+    ErrorDiffusion(data, width, height, kernel, bColor);
+    return true;
+}// Dither_Diffuse
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 //      Composite the current image over the given image.  Return success of 
@@ -591,19 +710,21 @@ bool TargaImage::Difference(TargaImage* pImage)
         return false;
     }// if
 
-    for (int i = 0 ; i < width * height * 4 ; i += 4)
-    {
-        unsigned char        rgb1[3];
-        unsigned char        rgb2[3];
+    ParallelRows(0, height, [this, pImage](int begin, int end) {
+        for (int i = begin * width * 4 ; i < end * width * 4 ; i += 4)
+        {
+            unsigned char        rgb1[3];
+            unsigned char        rgb2[3];
 
-        RGBA_To_RGB(data + i, rgb1);
-        RGBA_To_RGB(pImage->data + i, rgb2);
+            RGBA_To_RGB(data + i, rgb1);
+            RGBA_To_RGB(pImage->data + i, rgb2);
 
-        data[i] = abs(rgb1[0] - rgb2[0]);
-        data[i+1] = abs(rgb1[1] - rgb2[1]);
-        data[i+2] = abs(rgb1[2] - rgb2[2]);
-        data[i+3] = 255;
-    }
+            data[i] = abs(rgb1[0] - rgb2[0]);
+            data[i+1] = abs(rgb1[1] - rgb2[1]);
+            data[i+2] = abs(rgb1[2] - rgb2[2]);
+            data[i+3] = 255;
+        }
+    });
 
     return true;
 }// Difference
@@ -611,48 +732,52 @@ bool TargaImage::Difference(TargaImage* pImage)
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 box filter on this image.  Return success of operation.
+//      Filter the image with the outer product of the given 1D kernel,
+//  treating the borders by the current edge mode.  Return success of
+//  operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Box() {
+bool TargaImage::Filter_Separable(const int* aWeights, int size) {
+    unsigned char* new_data = new unsigned char[(size_t)width * height * 4];
 
-    uint8_t * new_data = new uint8_t[(this->height * this->width) << 2];
+    ConvolveSeparable(data, new_data, width, height, aWeights, size, CurrentEdgeMode());
 
-    for (int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++){
-            uint32_t Rtotal = 0, Gtotal = 0, Btotal = 0;
-            int32_t count = 0;
-            size_t index = ((i * width) << 2) + j * 4;
+    delete[] data;
+    data = new_data;
+    return true;
+}// Filter_Separable
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 box filter on this image.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box() {
+    static const int filter[5] = {1, 1, 1, 1, 1};
+    return Filter_Separable(filter, 5);
+}// Filter_Box
 
-            new_data[index + 3] = data[index + 3];
 
-            for(int m = 0; m < 5; m++){
-                for(int n = 0; n < 5; n++){
-                    static size_t shift_x, shift_y;
-                    shift_x = (i + m - 2);
-                    shift_y = (j + n - 2);
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform a box filter of the given radius on this image, at constant
+//  cost per pixel.  Fails for radii outside [0, c_maxBoxRadius], whose
+//  window sums would overflow.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Box_N(int radius) {
+    if (radius < 0 || radius > c_maxBoxRadius)
+        return false;
 
-                    if(shift_x < 0 || shift_x >= height){ continue; }
-                    if(shift_y < 0 || shift_y >= width){ continue; }
+    unsigned char* new_data = new unsigned char[(size_t)width * height * 4];
 
-                    static size_t in_index;
-                    in_index = shift_x * width * 4 + shift_y * 4;
-                    Rtotal += data[in_index+0];
-                    Gtotal += data[in_index+1];
-                    Btotal += data[in_index+2];
-                    count ++;
-                }
-            }
+    BoxFilter(data, new_data, width, height, radius, CurrentEdgeMode());
 
-            new_data[index + 0] = static_cast<uint8_t>(Rtotal / count);
-            new_data[index + 1] = static_cast<uint8_t>(Gtotal / count);
-            new_data[index + 2] = static_cast<uint8_t>(Btotal / count);
-        }
-    }
     delete[] data;
     data = new_data;
     return true;
-}// Filter_Box
+}// Filter_Box_N
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -662,118 +787,72 @@ bool TargaImage::Filter_Box() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Bartlett() {
+    return Filter_Separable(BARTLETT, 5);
+}// Filter_Bartlett
 
-    uint8_t * new_data = new uint8_t[(this->height * this->width) << 2];
 
-    const static int filter[5][5] = {
-        {1, 3, 5, 3, 1},
-        {3, 9, 15, 9, 3},
-        {5, 15, 25, 15, 5},
-        {3, 9, 15, 9, 3},
-        {1, 3, 5, 3, 1}
-    };
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform 5x5 Gaussian filter on this image, using the binomial weights
+//  1 4 6 4 1 along each axis.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian() {
+    static const int filter[5] = {1, 4, 6, 4, 1};
+    return Filter_Separable(filter, 5);
+}// Filter_Gaussian
 
-    for (int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++){
-            uint32_t Rtotal = 0, Gtotal = 0, Btotal = 0;
-            int32_t count = 0;
-            size_t index = ((i * width) << 2) + j * 4;
-
-            new_data[index + 3] = data[index + 3];
-
-            for(int m = 0; m < 5; m++){
-                for(int n = 0; n < 5; n++){
-                    static size_t shift_x, shift_y;
-                    shift_x = (i + m - 2);
-                    shift_y = (j + n - 2);
-
-                    if(shift_x < 0 || shift_x >= height){ continue; }
-                    if(shift_y < 0 || shift_y >= width){ continue; }
-
-                    static size_t in_index;
-                    in_index = shift_x * width * 4 + shift_y * 4;
-                    Rtotal += data[in_index+0] * filter[m][n];
-                    Gtotal += data[in_index+1] * filter[m][n];
-                    Btotal += data[in_index+2] * filter[m][n];
-                    count  += filter[m][n];
-                }
-            }
+///////////////////////////////////////////////////////////////////////////////
+//
+//      Perform NxN Gaussian filter on this image, N odd, using binomial
+//  weights along each axis.  Return success of operation.
+//
+///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_Gaussian_N( unsigned int N ) {
+    if (N % 2 != 1)
+        return false;
 
-            new_data[index + 0] = static_cast<uint8_t>(Rtotal / count);
-            new_data[index + 1] = static_cast<uint8_t>(Gtotal / count);
-            new_data[index + 2] = static_cast<uint8_t>(Btotal / count);
-        }
-    }
-    delete[] data;
-    data = new_data;
-    return true;
-}// Filter_Bartlett
+    const vector<int>& vKernel = Gaussian_Kernel(N);
+    return Filter_Separable(&vKernel[0], (int)vKernel.size());
+}// Filter_Gaussian_N
 
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform 5x5 Gaussian filter on this image.  Return success of 
-//  operation.
+//      Perform a Gaussian blur of the given standard deviation, at least 0.5,
+//  at a cost per pixel independent of it.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
-bool TargaImage::Filter_Gaussian() {
-    uint8_t * new_data = new uint8_t[(this->height * this->width) << 2];
-
-    const static int filter[5][5] = {
-        {1, 4, 7, 4, 1},
-        {4, 16, 26, 16, 4},
-        {7, 26, 41, 26, 7},
-        {4, 16, 26, 16, 4},
-        {1, 4, 7, 4, 1}
-    };
+bool TargaImage::Filter_Gaussian_Sigma(float sigma) {
+    if (!(sigma >= 0.5f))
+        return false;
 
-    for (int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++){
-            uint32_t Rtotal = 0, Gtotal = 0, Btotal = 0;
-            int32_t count = 0;
-            size_t index = ((i * width) << 2) + (j << 2);
-
-            new_data[index + 3] = data[index + 3];
-
-            for(int m = 0; m < 5; m++){
-                for(int n = 0; n < 5; n++){
-                    static size_t shift_x, shift_y;
-                    shift_x = (i + m - 2);
-                    shift_y = (j + n - 2);
-
-                    if(shift_x < 0 || shift_x >= height){ continue; }
-                    if(shift_y < 0 || shift_y >= width){ continue; }
-
-                    static size_t in_index;
-                    in_index = shift_x * width * 4 + shift_y * 4;
-                    Rtotal += data[in_index+0] * filter[m][n];
-                    Gtotal += data[in_index+1] * filter[m][n];
-                    Btotal += data[in_index+2] * filter[m][n];
-                    count  += filter[m][n];
-                }
-            }
+    unsigned char* new_data = new unsigned char[(size_t)width * height * 4];
+
+    RecursiveGaussian(data, new_data, width, height, sigma);
 
-            new_data[index + 0] = static_cast<uint8_t>(Rtotal / count);
-            new_data[index + 1] = static_cast<uint8_t>(Gtotal / count);
-            new_data[index + 2] = static_cast<uint8_t>(Btotal / count);
-        }
-    }
     delete[] data;
     data = new_data;
     return true;
-}// Filter_Gaussian
+}// Filter_Gaussian_Sigma
+
 
 ///////////////////////////////////////////////////////////////////////////////
 //
-//      Perform NxN Gaussian filter on this image.  Return success of 
-//  operation.
+//      Replace the image by its 5x5 high pass, the image minus its Bartlett
+//  filtered self, or with bEnhance add that edge response onto the image.
+//  Both come out of a single convolution pass.  Return success of operation.
 //
 ///////////////////////////////////////////////////////////////////////////////
+bool TargaImage::Filter_High_Pass(bool bEnhance) {
+    unsigned char* new_data = new unsigned char[(size_t)width * height * 4];
 
-bool TargaImage::Filter_Gaussian_N( unsigned int N ) {
-    ClearToBlack();
-   return false;
-}// Filter_Gaussian_N
+    HighPassSeparable(data, new_data, width, height, BARTLETT, 5, CurrentEdgeMode(), bEnhance);
+
+    delete[] data;
+    data = new_data;
+    return true;
+}// Filter_High_Pass
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -783,8 +862,7 @@ bool TargaImage::Filter_Gaussian_N( unsigned int N ) {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Edge() {
-    ClearToBlack();
-    return true;
+    return Filter_High_Pass(false);
 }// Filter_Edge
 
 
@@ -795,8 +873,7 @@ bool TargaImage::Filter_Edge() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Filter_Enhance() {
-    ClearToBlack();
-    return false;
+    return Filter_High_Pass(true);
 }// Filter_Enhance
 
 
@@ -821,45 +898,9 @@ bool TargaImage::NPR_Paint() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 bool TargaImage::Half_Size() {
+    unsigned char* new_data = new unsigned char[(size_t)(width >> 1) * (height >> 1) * 4];
 
-    uint8_t * new_data = new uint8_t[(this->height>>1) * (this->width>>1) << 2];
-
-    const static int filter[3][3] = {
-        {1, 2, 1},
-        {2, 4, 2},
-        {1, 2, 1}
-    };
-
-    for (int i = 0; i < (height >> 1); i++) {
-        for(int j = 0; j < (width >> 1); j++){
-            uint32_t Rtotal = 0, Gtotal = 0, Btotal = 0;
-            int32_t count = 0;
-            size_t index = (i * (width >> 1))  * 4 + j * 4;
-
-            for(int m = 0; m < 3; m++){
-                for(int n = 0; n < 3; n++){
-                    static size_t shift_x, shift_y;
-                    shift_x = ((i << 1) + m - 1);
-                    shift_y = ((j << 1) + n - 1);
-
-                    if(shift_x < 0 || shift_x >= height){ continue; }
-                    if(shift_y < 0 || shift_y >= width){ continue; }
-
-                    static size_t in_index;
-                    in_index = shift_x * width * 4 + shift_y * 4;
-                    Rtotal += data[in_index+0] * filter[m][n];
-                    Gtotal += data[in_index+1] * filter[m][n];
-                    Btotal += data[in_index+2] * filter[m][n];
-                    new_data[index + 3] = data[in_index + 3];
-                    count  += filter[m][n];
-                }
-            }
-
-            new_data[index + 0] = static_cast<uint8_t>(Rtotal / count);
-            new_data[index + 1] = static_cast<uint8_t>(Gtotal / count);
-            new_data[index + 2] = static_cast<uint8_t>(Btotal / count);
-        }
-    }
+    HalveImage(data, new_data, width, height, CurrentEdgeMode());
 
     delete[] data;
     data = new_data;
@@ -910,45 +951,49 @@ bool TargaImage::Rotate(float angleDegrees) {
         {1, 3, 3, 1}
     };
 
-    for(int i = 0; i < height; i++){
-        for(int j = 0; j < width; j++){
-            for(int k = 0; k < 4; k++){
-                double sum = 0, cnt = 0;
-                for(int m = 0; m < 4; m++){
-                    for(int n = 0; n < 4; n++){
-                        if((i + m - 2) < 0 || (j + n - 2) < 0 || (i + m - 2) >= height || (j + n - 2) >= width){
-                            continue;
+    ParallelRows(0, height, [&](int begin, int end) {
+        for(int i = begin; i < end; i++){
+            for(int j = 0; j < width; j++){
+                for(int k = 0; k < 4; k++){
+                    double sum = 0, cnt = 0;
+                    for(int m = 0; m < 4; m++){
+                        for(int n = 0; n < 4; n++){
+                            if((i + m - 2) < 0 || (j + n - 2) < 0 || (i + m - 2) >= height || (j + n - 2) >= width){
+                                continue;
+                            }
+                            size_t index = (((i + m - 2) * width) << 2) + ((j + n - 2) << 2);
+                            sum += data[index + k] * filter[m][n];
+                            cnt += filter[m][n];
                         }
-                        size_t index = (((i + m - 2) * width) << 2) + ((j + n - 2) << 2);
-                        sum += data[index + k] * filter[m][n];
-                        cnt += filter[m][n];
                     }
+                new_data[((i * width) << 2) + (j << 2) + k] = sum / cnt;
                 }
-            new_data[((i * width) << 2) + (j << 2) + k] = sum / cnt;
             }
         }
-    }
+    });
 
     ClearToBlack();
     angleDegrees = -angleDegrees;
-    for(int i = 0; i < height; i++){
-        for(int j = 0; j < width; j++){
-            for(int k = 0; k < 4; k++){
-                int FixI = i - height / 2, FixJ = j - width / 2;
-
-                int rotated_i = cos(angleDegrees * c_pi / 180.f) * FixI
-                    + sin(angleDegrees * c_pi / 180.f) * FixJ + height / 2;
-                int rotated_j = cos(angleDegrees * c_pi / 180.f) * FixJ
-                    - sin(angleDegrees * c_pi / 180.f) * FixI + width / 2;
-
-                if(rotated_i < 0 || rotated_j < 0 || rotated_i >= height || rotated_j >= width){
-                    continue;
+    ParallelRows(0, height, [&](int begin, int end) {
+        for(int i = begin; i < end; i++){
+            for(int j = 0; j < width; j++){
+                for(int k = 0; k < 4; k++){
+                    int FixI = i - height / 2, FixJ = j - width / 2;
+
+                    int rotated_i = cos(angleDegrees * c_pi / 180.f) * FixI
+                        + sin(angleDegrees * c_pi / 180.f) * FixJ + height / 2;
+                    int rotated_j = cos(angleDegrees * c_pi / 180.f) * FixJ
+                        - sin(angleDegrees * c_pi / 180.f) * FixI + width / 2;
+
+                    if(rotated_i < 0 || rotated_j < 0 || rotated_i >= height || rotated_j >= width){
+                        continue;
+                    }
+                    data[((i * width) << 2) + (j << 2) + k]
+                        = new_data[((rotated_i * width) << 2) + (rotated_j << 2) + k];
                 }
-                data[((i * width) << 2) + (j << 2) + k]
-                    = new_data[((rotated_i * width) << 2) + (rotated_j << 2) + k];
             }
         }
-    }
+    });
     delete[] new_data;
 
     return true;
@@ -1003,24 +1048,19 @@ TargaImage* TargaImage::Reverse_Rows(void)
 {
     unsigned char   *dest = new unsigned char[width * height * 4];
     TargaImage	    *result;
-    int 	        i, j;
 
     if (! data)
     	return NULL;
 
-    for (i = 0 ; i < height ; i++)
-    {
-	    int in_offset = (height - i - 1) * width * 4;
-	    int out_offset = ((i * width) << 2);
-
-	    for (j = 0 ; j < width ; j++)
+    ParallelRows(0, height, [this, dest](int begin, int end) {
+        for (int i = begin ; i < end ; i++)
         {
-	        dest[out_offset + j * 4] = data[in_offset + j * 4];
-	        dest[out_offset + j * 4 + 1] = data[in_offset + j * 4 + 1];
-	        dest[out_offset + j * 4 + 2] = data[in_offset + j * 4 + 2];
-	        dest[out_offset + j * 4 + 3] = data[in_offset + j * 4 + 3];
+	        int in_offset = (height - i - 1) * width * 4;
+	        int out_offset = ((i * width) << 2);
+
+	        memcpy(dest + out_offset, data + in_offset, width * 4);
         }
-    }
+    });
 
     result = new TargaImage(width, height, dest);
     delete[] dest;
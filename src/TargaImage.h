@@ -15,9 +15,11 @@
 #include <Fl/Fl.h>
 #include <Fl/Fl_Widget.h>
 #include <stdio.h>
+#include "ErrorDiffusion.h"
 
 class Stroke;
 class DistanceImage;
+class PointChain;
 
 class TargaImage
 {
@@ -37,14 +39,25 @@ class TargaImage
 
         bool Quant_Uniform();
         bool Quant_Populosity();
+        bool Quant_Populosity_Shared();             // map with the palette shared across images
+        bool Sample_Shared_Palette();               // add this image to the shared palette sample
         bool Quant_Median();
+        bool Quant_Octree(int nColors);
+        bool Quant_KMeans(int nIterations);
 
         bool Dither_Threshold();
         bool Dither_Random();
         bool Dither_FS();
+        bool Dither_FS_Raster();                    // raster order, parallel across rows
         bool Dither_Bright();
         bool Dither_Cluster();
+        bool Dither_Cluster(int size);              // generated cluster matrix of size 2, 4, 8 or 16
+        bool Dither_Pattern(int size);              // Bayer matrix of size 2, 4, 8 or 16
+        bool Dither_Blue_Noise();
         bool Dither_Color();
+        bool Dither_Diffuse(EDiffusionKernel kernel, bool bColor);
+
+        bool Apply_Point_Chain(const PointChain& chain);    // fused pass over a chain of point operations
 
         bool Comp_Over(TargaImage* pImage);
         bool Comp_In(TargaImage* pImage);
@@ -55,9 +68,11 @@ class TargaImage
         bool Difference(TargaImage* pImage);
 
         bool Filter_Box();
+        bool Filter_Box_N(int radius);              // (2 radius + 1)^2 box, constant cost per pixel
         bool Filter_Bartlett();
         bool Filter_Gaussian();
         bool Filter_Gaussian_N(unsigned int N);
+        bool Filter_Gaussian_Sigma(float sigma);    // recursive, constant cost per pixel
         bool Filter_Edge();
         bool Filter_Enhance();
 
@@ -77,6 +92,12 @@ class TargaImage
         // reverse the rows of the image, some targas are stored bottom to top
 	TargaImage* Reverse_Rows(void);
 
+        // filter with the outer product of a 1D kernel, renormalising at borders
+        bool Filter_Separable(const int* aWeights, int size);
+
+        // replace the image by its edge response, or add that onto it
+        bool Filter_High_Pass(bool bEnhance);
+
 	// clear image to all black
         void ClearToBlack();
 
@@ -53,7 +53,14 @@
 #define TGA_ERR_BAD_DIMENSIONS          (11)
 
 
-static uint32 TargaError;
+/* the last error is kept per thread so images can load and save concurrently */
+#if defined(_MSC_VER)
+    #define TGA_THREAD_LOCAL __declspec(thread)
+#else
+    #define TGA_THREAD_LOCAL __thread
+#endif
+
+static TGA_THREAD_LOCAL uint32 TargaError;
 
 
 static int16 ttohs( int16 val );